@@ -0,0 +1,56 @@
+#ifndef AUDIOBACKEND_H
+#define AUDIOBACKEND_H
+
+/* A short MIDI message, 'frame' frames into the current period. */
+struct MidiEvent {
+  unsigned int frame;
+  unsigned int size;
+  unsigned char data[3];
+};
+
+/* Receives the callbacks of an AudioBackend. process() is called from
+ * the backend's audio thread and has to be realtime safe. */
+class AudioClient {
+
+public:
+  virtual ~AudioClient() {};
+
+  virtual int process(unsigned int nframes) = 0;
+  // called before the first process() with a new period size, never
+  // concurrently with process()
+  virtual int bufferSizeChanged(unsigned int nframes) = 0;
+};
+
+/* Drives an AudioClient and owns its output ports. Ports are
+ * identified by their index, starting at 0. */
+class AudioBackend {
+
+public:
+  virtual ~AudioBackend() {};
+
+  // register the client that receives the callbacks, before activate()
+  virtual bool open(AudioClient *client) = 0;
+  virtual void activate() = 0;
+  virtual void deactivate() = 0;
+
+  virtual unsigned int sampleRate() const = 0;
+  virtual unsigned int bufferSize() const = 0;
+
+  // add output port 'index' (ports are added in order); may be called
+  // while active, but not from process()
+  virtual bool addOutput(unsigned int index) = 0;
+  // buffer for output port 'index' in the current period; only valid
+  // inside process()
+  virtual float *outputBuffer(unsigned int index, unsigned int nframes) = 0;
+
+  // add the MIDI input port; backends without MIDI return false
+  virtual bool addMidiInput() { return false; }
+  // copy up to 'max' MIDI events of the current period to 'events', in
+  // the order of their frames, and return how many were copied. Only
+  // valid inside process(); longer messages (e.g. SysEx) are skipped.
+  virtual unsigned int midiEvents(unsigned int nframes __attribute__ ((unused)),
+                                  MidiEvent *events __attribute__ ((unused)),
+                                  unsigned int max __attribute__ ((unused)) ) { return 0; }
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include "batchslicer.h"
+#include "beattracker.h"
+#include "onsetdetector.h"
+#include "samplemap.h"
+#include "sliceexporter.h"
+#include "soundfilehandler.h"
+#include "wave.h"
+#include "workstealingpool.h"
+#include "zerocrossings.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QStringList>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+// how far a cut may move to a zero crossing, in seconds, as in Cutter
+static const double snapDistance = 0.01;
+// a file longer than this, in seconds, is worth splitting up
+static const double longFile = 300.;
+// seconds of audio per export task of a long file
+static const double exportGroup = 30.;
+// shortest fixed slice, in seconds
+static const double minFixedSlice = 0.01;
+
+struct SliceRules {
+  enum Method { Onsets, Grid, Fixed, Silence };
+  Method method;
+  double sensitivity; // Onsets
+  double beats; // Grid: beats per cut
+  double seconds; // Fixed: slice length; Silence: shortest gap
+  double silenceDb; // Silence: level below which it is silent
+};
+
+struct FileResult {
+  string name;
+  unsigned int sampleRate;
+  unsigned long frames;
+  vector<ExportJob> slices;
+  double analysisSeconds;
+  double exportSeconds;
+  string error;
+};
+
+static double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/* rule[:parameter[:parameter]] */
+static SliceRules parseRules(const QString &rule) {
+  SliceRules rules{SliceRules::Onsets, 0.5, 4., 1., -50.};
+  const auto parts = rule.split(':');
+  const auto name = parts[0];
+  bool ok = true;
+  if (name == "onset") {
+    rules.method = SliceRules::Onsets;
+    if (parts.size() > 1) {
+      rules.sensitivity = parts[1].toDouble(&ok);
+    }
+  } else if (name == "grid") {
+    rules.method = SliceRules::Grid;
+    const QStringList steps = QStringList() << "bars" << "beats" << "eighths" << "sixteenths";
+    const auto step = parts.size() > 1 ? steps.indexOf(parts[1]) : 0;
+    ok = (step >= 0);
+    // bars in 4/4, then halving the step each time
+    rules.beats = step == 0 ? 4. : 1./(1 << (step - 1));
+  } else if (name == "fixed") {
+    rules.method = SliceRules::Fixed;
+    if (parts.size() > 1) {
+      rules.seconds = parts[1].toDouble(&ok);
+    }
+    if (ok && rules.seconds < minFixedSlice) {
+      throw std::invalid_argument("Fixed slices must be at least "
+                                  + QString::number(minFixedSlice).toStdString() + " s");
+    }
+  } else if (name == "silence") {
+    rules.method = SliceRules::Silence;
+    rules.seconds = 0.1;
+    if (parts.size() > 1) {
+      rules.silenceDb = parts[1].toDouble(&ok);
+    }
+    if (ok && parts.size() > 2) {
+      rules.seconds = parts[2].toDouble(&ok);
+    }
+  } else {
+    ok = false;
+  }
+  if (!ok) {
+    throw std::invalid_argument("Unknown slicing rule: " + rule.toStdString());
+  }
+  return rules;
+}
+
+/* A cut where the sound comes back after at least minSeconds below
+ * silenceDb, judged in blocks of 10 ms. */
+static vector<unsigned int> silenceCuts(const Wave &wave, double silenceDb, double minSeconds) {
+  vector<unsigned int> cuts;
+  const unsigned long frames = wave.samples.size() / wave.channels;
+  const unsigned long block = std::max(1u, wave.samplerate / 100);
+  const unsigned long minBlocks = std::max(1l, lround(minSeconds * wave.samplerate / block));
+  const float threshold = std::pow(10., silenceDb / 20.);
+  unsigned long silentBlocks = 0;
+  for(unsigned long start=0; start < frames; start += block) {
+    const auto *first = &wave.samples[start*wave.channels];
+    const auto *last = &wave.samples[std::min(start + block, frames)*wave.channels];
+    const bool silent = std::all_of(first, last, [threshold] (float s) {
+        return std::fabs(s) < threshold;
+      });
+    if (silent) {
+      ++silentBlocks;
+    } else {
+      if (silentBlocks >= minBlocks) {
+        cuts.push_back(start);
+      }
+      silentBlocks = 0;
+    }
+  }
+  return cuts;
+}
+
+/* The cuts of the wave by rules, from 0 to the end, the ones in
+ * between snapped to zero crossings. */
+static vector<unsigned int> findCuts(const Wave &wave, const SliceRules &rules, unsigned int threads) {
+  const unsigned long frames = wave.samples.size() / wave.channels;
+  vector<unsigned int> found;
+  switch (rules.method) {
+  case SliceRules::Onsets:
+    found = OnsetDetector(wave).detect(rules.sensitivity, threads);
+    break;
+  case SliceRules::Grid:
+    found = BeatTracker(wave).estimate(60., 180., threads).lines(frames, rules.beats);
+    break;
+  case SliceRules::Fixed: {
+    const double step = rules.seconds * wave.samplerate;
+    for(double f=step; f < frames; f += step) {
+      found.push_back(lround(f));
+    }
+    break;
+  }
+  case SliceRules::Silence:
+    found = silenceCuts(wave, rules.silenceDb, rules.seconds);
+    break;
+  }
+
+  const ZeroCrossings crossings(wave, threads);
+  const unsigned long maxDistance = lround(snapDistance * wave.samplerate);
+  vector<unsigned int> cuts{0};
+  for(auto frame : found) {
+    if (frame > 0 && frame < frames) {
+      cuts.push_back(crossings.snap(frame, maxDistance));
+    }
+  }
+  cuts.push_back(frames);
+  std::sort(cuts.begin(), cuts.end());
+  cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+  return cuts;
+}
+
+/* The name of each file without its extension, to name its slices and
+ * their directory after. Files that differ only in their extension, or
+ * in case, would write over each other's slices: the later ones get
+ * -2, -3, ... appended. */
+static QStringList outputNames(const QFileInfoList &files) {
+  QStringList names;
+  QSet<QString> taken;
+  for(const auto &file : files) {
+    const auto base = file.completeBaseName();
+    auto name = base;
+    for(int n=2; taken.contains(name.toLower()); ++n) {
+      name = base + QString("-%1").arg(n);
+    }
+    taken.insert(name.toLower());
+    names << name;
+  }
+  return names;
+}
+
+/* Read, cut and export one file, naming the slices after base. A long
+ * file's slices are written by subtasks, so that idle workers can steal
+ * them. */
+static void sliceFile(const QFileInfo &file, const QString &base, const QDir &outDir,
+                      const SliceRules &rules,
+                      const ExportFormat &format, const SoundFileHandler &reader,
+                      WorkStealingPool &pool, FileResult &result) {
+  const auto start = Clock::now();
+  const Wave wave = reader.read(file.filePath());
+  result.sampleRate = wave.samplerate;
+  result.frames = wave.samples.size() / wave.channels;
+  if (!result.frames) {
+    throw std::runtime_error("No audio");
+  }
+  const bool isLong = result.frames > longFile * wave.samplerate;
+
+  // near the end of a batch, a long file can have the workers to itself
+  const auto cuts = findCuts(wave, rules, isLong ? 1 + pool.idle() : 1);
+  result.analysisSeconds = since(start);
+
+  if (!outDir.mkpath(base)) {
+    throw std::runtime_error("Can't create directory " + outDir.filePath(base).toStdString());
+  }
+  // decimals needed for the number of slices, as in Cutter::exportSamples()
+  const int nDecimals = 1 + floor(log10(cuts.size() - 1));
+  for(unsigned int i=1; i < cuts.size(); ++i) {
+    const auto name = outDir.filePath(base + "/" + base + QString("%1.wav").arg(i, nDecimals, 10, QChar('0')));
+    result.slices.push_back(ExportJob{name.toLocal8Bit().constData(), cuts[i - 1], cuts[i]});
+  }
+
+  const auto exportStart = Clock::now();
+  if (!isLong) {
+    SliceExporter(wave, format).run(result.slices);
+  } else {
+    std::atomic<unsigned int> groups(0);
+    std::mutex errorMutex;
+    string error;
+    const unsigned long groupFrames = exportGroup * wave.samplerate;
+    for(auto first = result.slices.begin(); first != result.slices.end(); ) {
+      auto last = first;
+      unsigned long frames = 0;
+      while (last != result.slices.end() && (last == first || frames < groupFrames)) {
+        frames += last->end - last->start;
+        ++last;
+      }
+      ++groups;
+      vector<ExportJob> jobs(first, last);
+      pool.submit([&, jobs] {
+          try {
+            SliceExporter(wave, format).run(jobs);
+          } catch (std::exception &e) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            error = e.what();
+          }
+          --groups;
+        });
+      first = last;
+    }
+    pool.helpUntilZero(groups);
+    if (!error.empty()) {
+      throw std::runtime_error(error);
+    }
+  }
+  result.exportSeconds = since(exportStart);
+}
+
+static void writeManifest(const string &fileName, const vector<FileResult> &results) {
+  std::ofstream out(fileName);
+  out << "{\n  \"files\": [";
+  for(unsigned int i=0; i < results.size(); ++i) {
+    const auto &r = results[i];
+    out << (i ? ",\n" : "\n")
+        << "    {\"file\": " << jsonString(r.name);
+    if (!r.error.empty()) {
+      out << ", \"error\": " << jsonString(r.error) << "}";
+      continue;
+    }
+    out << ", \"sampleRate\": " << r.sampleRate
+        << ", \"frames\": " << r.frames
+        << ", \"seconds\": " << r.analysisSeconds + r.exportSeconds
+        << ", \"slices\": [";
+    for(unsigned int j=0; j < r.slices.size(); ++j) {
+      const auto &s = r.slices[j];
+      out << (j ? ",\n" : "\n")
+          << "      {\"file\": " << jsonString(s.fileName)
+          << ", \"start\": " << s.start << ", \"end\": " << s.end << "}";
+    }
+    out << "\n    ]}";
+  }
+  out << "\n  ]\n}\n";
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Error writing file " + fileName);
+  }
+}
+
+int batchSlice(const QStringList &args) {
+  auto value = [&args] (const QString &option, const QString &fallback) {
+    const auto i = args.indexOf(option);
+    return (i >= 0 && i + 1 < args.size()) ? args[i + 1] : fallback;
+  };
+  const QDir inDir(value("--batch", QString()));
+  const QDir outDir(value("--out", inDir.filePath("slices")));
+  const unsigned int threads = value("--threads", "0").toUInt();
+
+  SliceRules rules;
+  ExportFormat format;
+  try {
+    rules = parseRules(value("--rules", "onset"));
+  } catch (std::invalid_argument &e) {
+    cerr << e.what() << endl;
+    return 2;
+  }
+  format.sampleRate = value("--rate", "0").toUInt();
+  format.bits = value("--bits", "16").toUInt();
+  format.gain = 1.f;
+  format.normalize = args.contains("--normalize");
+  format.dither = true;
+  format.noiseShaping = false;
+  if (format.bits != 16 && format.bits != 24 && format.bits != 32) {
+    cerr << "Bits must be 16, 24 or 32" << endl;
+    return 2;
+  }
+
+  const QStringList patterns = QStringList() << "*.wav" << "*.flac" << "*.aif" << "*.aiff"
+                                             << "*.ogg" << "*.mp3";
+  const auto files = inDir.entryInfoList(patterns, QDir::Files, QDir::Name);
+  if (files.isEmpty()) {
+    cerr << "No sound files in " << inDir.path().toStdString() << endl;
+    return 2;
+  }
+  if (!outDir.mkpath(".")) {
+    cerr << "Can't create directory " << outDir.path().toStdString() << endl;
+    return 2;
+  }
+
+  const auto names = outputNames(files);
+  const SoundFileHandler reader;
+  vector<FileResult> results(files.size());
+  std::mutex printMutex;
+  const auto start = Clock::now();
+  {
+    WorkStealingPool pool(threads);
+    for(int i=0; i < files.size(); ++i) {
+      pool.submit([&, i] {
+          auto &result = results[i];
+          result.name = files[i].fileName().toStdString();
+          try {
+            sliceFile(files[i], names[i], outDir, rules, format, reader, pool, result);
+          } catch (std::exception &e) {
+            result.error = e.what();
+          }
+          std::lock_guard<std::mutex> lock(printMutex);
+          if (result.error.empty()) {
+            cout << result.name << ": " << result.slices.size() << " slices in "
+                 << result.analysisSeconds + result.exportSeconds << " s (analysis "
+                 << result.analysisSeconds << " s, export " << result.exportSeconds << " s)" << endl;
+          } else {
+            cerr << result.name << ": " << result.error << endl;
+          }
+        });
+    }
+  }
+  const double seconds = since(start);
+
+  const auto failed = std::count_if(results.begin(), results.end(), [] (const FileResult &r) {
+      return !r.error.empty();
+    });
+  cout << files.size() << " files in " << seconds << " s, " << files.size() / seconds
+       << " files/s";
+  if (failed) {
+    cout << ", " << failed << " failed";
+  }
+  cout << endl;
+
+  try {
+    writeManifest(outDir.filePath("manifest.json").toLocal8Bit().constData(), results);
+  } catch (std::runtime_error &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
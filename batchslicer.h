@@ -0,0 +1,26 @@
+#ifndef BATCHSLICER_H
+#define BATCHSLICER_H
+
+class QStringList;
+
+/* Slice every sound file in a directory without a GUI:
+ *
+ *   --batch <dir> [--rules <rule>] [--out <dir>] [--threads <n>]
+ *                 [--rate <Hz>] [--bits 16|24|32] [--normalize]
+ *
+ * rule is one of onset[:sensitivity], grid[:bars|beats|eighths|
+ * sixteenths], fixed[:seconds] or silence[:dBFS[:seconds]]. Cuts are
+ * snapped to zero crossings, as in the editor, and the slices of each
+ * file written to <out>/<name>/<name>01.wav... (default out:
+ * <dir>/slices), with a manifest.json listing them all. name is the
+ * file name without its extension, with -2, -3... appended if an
+ * earlier file already has it. Fixed slices are at least 10 ms.
+ *
+ * One task per file runs on a WorkStealingPool. A long file also
+ * analyses on the workers left idle, and hands its slices out in groups
+ * that idle workers steal, so that one hour-long file doesn't keep the
+ * batch waiting on one core. Prints the time taken per file and the
+ * files per second overall; returns 0 if every file was sliced. */
+int batchSlice(const QStringList &args);
+
+#endif
@@ -0,0 +1,209 @@
+#include "beattracker.h"
+#include "onsetdetector.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using std::vector;
+
+// tempo the period prior is centered on, and its width in octaves
+static const double preferredBpm = 120.;
+static const double priorOctaves = 1.;
+// the comb tries periods this far (in hops) around the autocorrelation
+// peak, in steps of periodStep, and phases in steps of phaseStep
+static const double periodSpan = 1.;
+static const double periodStep = 0.01;
+static const double phaseStep = 0.5;
+
+constexpr double BeatGrid::minConfidence;
+
+vector<unsigned int> BeatGrid::lines(unsigned long frames, double beats) const {
+  vector<unsigned int> result;
+  const double step = beats*beatFrames;
+  if (step <= 0.) {
+    return result;
+  }
+  const double start = fmod(firstBar, step);
+  for(unsigned long k=0; start + k*step < frames; ++k) {
+    result.push_back(lround(start + k*step));
+  }
+  return result;
+}
+
+unsigned long BeatGrid::nearest(unsigned long frame, double beats) const {
+  const double step = beats*beatFrames;
+  if (step <= 0.) {
+    return frame;
+  }
+  const double k = round((frame - firstBar)/step);
+  const double line = firstBar + k*step;
+  return lround(line >= 0. ? line : line + step);
+}
+
+void BeatGrid::snapLoop(unsigned int &start, unsigned int &end, unsigned long frames) const {
+  const double bar = beatsPerBar*beatFrames;
+  if (bar <= 0. || end <= start) {
+    return;
+  }
+  const auto newStart = nearest(start, 1.);
+  const auto newEnd = lround(newStart + std::max(1l, lround((end - start)/bar))*bar);
+  if (static_cast<unsigned long>(newEnd) <= frames) {
+    start = newStart;
+    end = newEnd;
+  }
+}
+
+/* Envelope e, linearly interpolated at hop x. */
+static inline double at(const vector<float> &e, double x) {
+  const auto i = static_cast<unsigned long>(x);
+  const double frac = x - i;
+  return (1. - frac)*e[i] + (i + 1 < e.size() ? frac*e[i + 1] : 0.);
+}
+
+/* Mean of e over the comb with teeth every 'period' hops from 'phase'. */
+static double comb(const vector<float> &e, double period, double phase) {
+  double sum = 0.;
+  unsigned long n = 0;
+  for(double x = phase; x < e.size(); x += period, ++n) {
+    sum += at(e, x);
+  }
+  return n ? sum/n : 0.;
+}
+
+/* Like comb(), but each tooth takes the peak of e within a hop of it,
+ * for comparing the accents of beats in the bar, where the period
+ * estimate may have drifted by a fraction of a hop. */
+static double peakComb(const vector<float> &e, double period, double phase) {
+  double sum = 0.;
+  unsigned long n = 0;
+  for(double x = phase; x < e.size(); x += period, ++n) {
+    const long i = lround(x);
+    const long from = std::max(0l, i - 1);
+    const long to = std::min<long>(e.size(), i + 2);
+    sum += *std::max_element(e.begin() + from, e.begin() + to);
+  }
+  return n ? sum/n : 0.;
+}
+
+/* Run f(i) for i in [first, last), split over 'threads' threads. */
+template<typename F>
+static void parallelFor(long first, long last, unsigned int threads, F f) {
+  vector<std::thread> pool;
+  const long chunk = std::max(1l, (last - first + threads - 1) / static_cast<long>(threads));
+  for(long from=first; from < last; from += chunk) {
+    const long to = std::min(from + chunk, last);
+    pool.emplace_back([from, to, &f] () {
+        for(long i=from; i < to; ++i) {
+          f(i);
+        }
+      });
+  }
+  for(auto &t : pool) {
+    t.join();
+  }
+}
+
+BeatTracker::BeatTracker(const Wave &wave) : wave(wave) {
+}
+
+BeatGrid BeatTracker::estimate(double minBpm, double maxBpm, unsigned int threads) const {
+  BeatGrid grid = {0., 0., 0., 4, 0.};
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // only rises of the flux mark beats. The hops whose window starts
+  // before the wave compare with silence: whatever the wave starts
+  // with looks like a huge onset there.
+  auto e = OnsetDetector(wave).envelope(threads);
+  const unsigned long lead = OnsetDetector::fftSize/2/OnsetDetector::hopSize;
+  for(unsigned long h=0; h < e.size(); ++h) {
+    e[h] = h < lead ? 0.f : std::max(0.f, e[h]);
+  }
+
+  const double hopsPerSecond = static_cast<double>(wave.samplerate) / OnsetDetector::hopSize;
+  const long minLag = std::max(1l, lround(floor(60.*hopsPerSecond/maxBpm)));
+  const long maxLag = lround(ceil(60.*hopsPerSecond/minBpm));
+  const long n = e.size();
+  // we need to see the slowest beat twice
+  if (n <= 2*maxLag + 1) {
+    return grid;
+  }
+
+  // autocorrelation, up to twice the longest period for the first
+  // harmonic
+  vector<double> acf(2*maxLag + 1, 0.);
+  parallelFor(minLag, 2*maxLag + 1, threads, [&e, &acf, n] (long lag) {
+      double sum = 0.;
+      for(long h=0; h + lag < n; ++h) {
+        sum += e[h]*e[h + lag];
+      }
+      acf[lag] = sum / (n - lag);
+    });
+
+  long bestLag = 0;
+  double bestScore = 0.;
+  for(long lag=minLag; lag <= maxLag; ++lag) {
+    const double bpm = 60.*hopsPerSecond/lag;
+    const double octaves = log2(bpm/preferredBpm)/priorOctaves;
+    const double score = (acf[lag] + 0.5*acf[2*lag]) * exp(-0.5*octaves*octaves);
+    if (score > bestScore) {
+      bestScore = score;
+      bestLag = lag;
+    }
+  }
+  if (!bestLag) {
+    return grid;
+  }
+
+  // refine the period and find the phase: the comb that collects the
+  // most onset energy
+  const long nPeriods = lround(2*periodSpan/periodStep) + 1;
+  vector<double> combScore(nPeriods, 0.);
+  vector<double> combPhase(nPeriods, 0.);
+  parallelFor(0, nPeriods, threads, [&] (long i) {
+      const double period = bestLag - periodSpan + i*periodStep;
+      for(double phase=0.; phase < period; phase += phaseStep) {
+        const double score = comb(e, period, phase);
+        if (score > combScore[i]) {
+          combScore[i] = score;
+          combPhase[i] = phase;
+        }
+      }
+    });
+  const long best = std::max_element(combScore.begin(), combScore.end()) - combScore.begin();
+  const double period = bestLag - periodSpan + best*periodStep;
+  const double phase = combPhase[best];
+
+  // the downbeat: the strongest of the beats in a bar
+  unsigned int downbeat = 0;
+  double strongest = 0.;
+  for(unsigned int b=0; b < grid.beatsPerBar; ++b) {
+    const double score = peakComb(e, grid.beatsPerBar*period, phase + b*period);
+    if (score > strongest) {
+      strongest = score;
+      downbeat = b;
+    }
+  }
+
+  // confidence: the correlation of the envelope with itself a beat
+  // later. Close to 1 for a steady beat, around 0 for noise or free
+  // playing.
+  double mean = 0., power = 0.;
+  for(auto v : e) {
+    mean += v;
+    power += v*v;
+  }
+  mean /= n;
+  power /= n;
+  const double variance = power - mean*mean;
+
+  grid.bpm = 60.*hopsPerSecond/period;
+  grid.beatFrames = period*OnsetDetector::hopSize;
+  grid.firstBar = fmod((phase + downbeat*period)*OnsetDetector::hopSize,
+                       grid.beatsPerBar*grid.beatFrames);
+  grid.confidence = variance > 0. ? std::max(0., (acf[bestLag] - mean*mean)/variance) : 0.;
+  return grid;
+}
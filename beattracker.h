@@ -0,0 +1,54 @@
+#ifndef BEATTRACKER_H
+#define BEATTRACKER_H
+
+#include <vector>
+
+class Wave;
+
+/* A regular grid of bars and beats, in frames of the wave it was
+ * estimated from. */
+struct BeatGrid {
+  // below this, the grid is a guess: don't snap anything to it
+  static constexpr double minConfidence = 0.3;
+
+  double bpm;
+  double beatFrames; // length of a beat
+  double firstBar; // first downbeat, within the first bar
+  unsigned int beatsPerBar;
+  double confidence; // 0 to 1
+
+  bool confident() const { return bpm > 0. && confidence >= minConfidence; }
+  // grid lines every 'beats' beats (4: bars, 0.5: eighths in 4/4)
+  // from frame 0 up to 'frames', in line with the downbeats
+  std::vector<unsigned int> lines(unsigned long frames, double beats) const;
+  // the grid line every 'beats' beats nearest to frame
+  unsigned long nearest(unsigned long frame, double beats) const;
+  // move a loop to start on the nearest beat and last a whole number of
+  // bars, if it still fits in 'frames'. The downbeat is the least
+  // reliable part of the estimate, so the start isn't forced onto it.
+  void snapLoop(unsigned int &start, unsigned int &end, unsigned long frames) const;
+};
+
+/* Estimates tempo and beat phase from the onset envelope of
+ * OnsetDetector. The period is the autocorrelation peak in the tempo
+ * range, weighted towards moderate tempos to avoid picking half or
+ * double time. It is then refined together with the phase by a comb
+ * over the whole envelope, so that long files don't drift off the
+ * grid. The autocorrelation and the comb run in parallel.
+ *
+ * The meter is assumed to be 4/4, with the strongest of the four beat
+ * positions on the downbeat, which is a guess more often than the tempo
+ * and the beats are. */
+class BeatTracker {
+
+public:
+  BeatTracker(const Wave &wave);
+
+  // threads: 0 to use one per core
+  BeatGrid estimate(double minBpm=60., double maxBpm=180., unsigned int threads=0) const;
+
+private:
+  const Wave &wave;
+};
+
+#endif
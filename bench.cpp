@@ -0,0 +1,343 @@
+#include "bench.h"
+#include "jackplayer.h"
+#include "nullbackend.h"
+#include "pcmquantizer.h"
+#include "resampler.h"
+#include "voicepool.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+static const double pi = 3.14159265358979323846;
+
+static double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/* seconds of a sine at freq Hz, in every channel */
+static Wave sine(double seconds, unsigned int rate, unsigned int channels, double freq,
+                 float amplitude=0.5f) {
+  const unsigned long frames = seconds*rate;
+  vector<float> samples(frames*channels);
+  for(unsigned long i=0; i < frames; ++i) {
+    const float s = amplitude*sin(2*pi*freq*i/rate);
+    for(unsigned int c=0; c < channels; ++c) {
+      samples[i*channels + c] = s;
+    }
+  }
+  return Wave(std::move(samples), channels, rate);
+}
+
+/* The largest step between neighbouring frames of channel 0 */
+static float maxStep(const vector<float> &x, unsigned int channels,
+                     unsigned long first, unsigned long last) {
+  float step = 0.f;
+  for(unsigned long i=first + 1; i < last; ++i) {
+    step = std::max(step, std::fabs(x[i*channels] - x[(i - 1)*channels]));
+  }
+  return step;
+}
+
+/* Time mix() with 0 to 16 voices playing, at the rate of the wave and
+ * from 44.1 kHz to 48 kHz, and steal a voice of a sine in the middle of
+ * a period. The crossfade of a steal may steepen the sine a little; a
+ * cut is a step of up to the amplitude, 75 times that of the sine. */
+static bool benchVoices() {
+  const unsigned int period = 256, channels = 2, periods = 20000;
+  for(unsigned int inRate : {48000u, 44100u}) {
+    const auto wave = sine(10., inRate, channels, 440.);
+    const double ratio = 48000./inRate;
+    auto filter = PolyphaseFilter::create(inRate, 48000, channels);
+    vector<float> mix(period*channels), scratch(period*channels);
+    double idle = 0.;
+    for(unsigned int n : {0u, 1u, 4u, 16u}) {
+      VoicePool pool(channels, filter);
+      const auto length = wave.samples.size();
+      for(unsigned int v=0; v < n; ++v) {
+        pool.trigger(0, length);
+      }
+      const auto start = Clock::now();
+      for(unsigned int p=0; p < periods; ++p) {
+        std::fill(mix.begin(), mix.end(), 0.f);
+        pool.mix(wave, ratio, mix.data(), scratch.data(), period);
+        if (pool.active() < n) {
+          // played to the end: start over
+          pool.release();
+          for(unsigned int v=0; v < n; ++v) {
+            pool.trigger(0, length);
+          }
+        }
+      }
+      const double perPeriod = since(start)/periods*1e6;
+      if (!n) {
+        idle = perPeriod;
+        continue;
+      }
+      cout << "voices: " << inRate << " Hz, " << n << " voices: "
+           << (perPeriod - idle)/n << " us per voice per " << period << "-frame period" << endl;
+    }
+  }
+
+  // one voice playing a sine, stolen by the same sine half a cycle
+  // later: without a fade, the output jumps by up to twice the amplitude
+  const unsigned int rate = 48000;
+  const auto wave = sine(1., rate, 1, 100.);
+  VoicePool pool(1, nullptr, 1);
+  const unsigned long frames = 8*period;
+  vector<float> out(frames, 0.f), scratch(period);
+  pool.trigger(0, wave.samples.size());
+  for(unsigned long done=0; done < frames; done += period) {
+    if (done == 4*period) {
+      pool.trigger(rate/200, wave.samples.size(), 1.f, period/2);
+    }
+    pool.mix(wave, 1., &out[done], scratch.data(), period);
+  }
+  const float steady = maxStep(out, 1, VoicePool::fadeFrames, 4*period);
+  const float steal = maxStep(out, 1, 4*period - 1, frames);
+  const bool clean = steal <= 4.f*steady;
+  cout << "voices: largest step " << steady << " steady, " << steal << " at the steal: "
+       << (clean ? "ok" : "CLICK") << endl;
+  return clean;
+}
+
+/* Loop exactly 10 cycles of a 441 Hz sine at 44.1 kHz, played at
+ * 48 kHz, for 40 passes. A seamless loop is a sine at the output too:
+ * its second difference stays within that of the sine, A (2 pi f/fs)^2.
+ * The discontinuity energy is the sum of the squares of what exceeds
+ * it; resetting the resampler at each wrap gave about 0.0045 per pass.
+ * The first two passes are left out, as the filter fills up there. */
+static bool benchLoopSeam() {
+  const unsigned int inRate = 44100, outRate = 48000, period = 256;
+  const double freq = 441.;
+  auto backend = new NullBackend(outRate, period, NullBackend::Manual);
+  JackPlayer player(0, 1, backend);
+  player.loadWave(sine(1., inRate, 1, freq, 1.f));
+  backend->run(period);
+
+  const unsigned int loopStart = 5000, loopEnd = 6000;
+  const double passFrames = (loopEnd - loopStart)*static_cast<double>(outRate)/inRate;
+  const unsigned int passes = 40;
+  player.setLoop(loopStart, loopEnd);
+  player.loop();
+  backend->capture(1);
+  backend->run((passes + 2)*passFrames);
+
+  const auto &out = backend->output();
+  const unsigned long first = 2*passFrames + period;
+  double amplitude = 0.;
+  for(unsigned long i=first; i < out.size(); ++i) {
+    amplitude = std::max(amplitude, std::fabs(static_cast<double>(out[i])));
+  }
+  const double bound = amplitude*pow(2*pi*freq/outRate, 2)*1.05;
+  double energy = 0., peak = 0.;
+  unsigned long silent = 0;
+  for(unsigned long i=first; i < out.size(); ++i) {
+    const double d = out[i] - 2*out[i - 1] + out[i - 2];
+    if (std::fabs(d) > bound) {
+      energy += d*d;
+    }
+    peak = std::max(peak, std::fabs(d));
+    silent += (out[i] == 0.f && out[i - 1] == 0.f);
+  }
+  const double measured = (out.size() - first)/passFrames;
+  const double perPass = energy/measured;
+  const bool ok = perPass < 1e-5 && !silent;
+  cout << "loop-seam: " << measured << " passes, discontinuity energy " << perPass
+       << " per pass, peak second difference " << peak << " (sine: " << bound/1.05 << "), "
+       << silent << " silent frames: " << (ok ? "ok" : "FAILED") << endl;
+  return ok;
+}
+
+/* Convert a wave period by period, as the engine does, with process()
+ * taking an SRC_DATA like src_process() */
+template<typename Process>
+static vector<float> convert(const Wave &in, double ratio, unsigned int period,
+                             Process process) {
+  const auto channels = in.channels;
+  const unsigned long inFrames = in.samples.size()/channels;
+  const unsigned long outFrames = inFrames*ratio;
+  vector<float> out(outFrames*channels);
+  unsigned long used = 0, gen = 0;
+  while (gen < outFrames) {
+    SRC_DATA data;
+    data.data_in = const_cast<float *>(&in.samples[used*channels]);
+    data.input_frames = inFrames - used;
+    data.data_out = &out[gen*channels];
+    data.output_frames = std::min<unsigned long>(period, outFrames - gen);
+    data.src_ratio = ratio;
+    data.end_of_input = 0;
+    const int error = process(data);
+    if (error) {
+      throw std::runtime_error(src_strerror(error));
+    }
+    if (!data.output_frames_gen) {
+      break;
+    }
+    used += data.input_frames_used;
+    gen += data.output_frames_gen;
+  }
+  out.resize(gen*channels);
+  return out;
+}
+
+/* Signal to noise ratio in dB of channel 0 of x as a sine at freq Hz:
+ * the sine is fitted by least squares, so that the delay and gain of a
+ * filter do not count, and everything else does. The first and last
+ * 'skip' frames are left out. */
+static double snr(const vector<float> &x, unsigned int channels, unsigned int rate,
+                  double freq, unsigned long skip) {
+  const unsigned long frames = x.size()/channels;
+  const double w = 2*pi*freq/rate;
+  double ss = 0., sc = 0., cc = 0., xs = 0., xc = 0.;
+  for(unsigned long i=skip; i + skip < frames; ++i) {
+    const double s = sin(w*i), c = cos(w*i), v = x[i*channels];
+    ss += s*s;
+    sc += s*c;
+    cc += c*c;
+    xs += v*s;
+    xc += v*c;
+  }
+  const double det = ss*cc - sc*sc;
+  const double a = (xs*cc - xc*sc)/det, b = (xc*ss - xs*sc)/det;
+  double signal = 0., noise = 0.;
+  for(unsigned long i=skip; i + skip < frames; ++i) {
+    const double fit = a*sin(w*i) + b*cos(w*i);
+    signal += fit*fit;
+    noise += (x[i*channels] - fit)*(x[i*channels] - fit);
+  }
+  return 10*log10(signal/noise);
+}
+
+/* The polyphase Resampler against libsamplerate, between 44.1 kHz and
+ * 48 kHz both ways, in stereo 256-frame periods. Quality is the SNR of
+ * a converted sine at 1 kHz and 15 kHz, with SRC_SINC_BEST_QUALITY as
+ * the reference; cost is output samples per second. The Resampler must
+ * match SRC_SINC_FASTEST on SNR, to within 1 dB, and beat it on cost. */
+static bool benchResampler() {
+  const unsigned int period = 256, channels = 2;
+  bool ok = true;
+  for(auto rates : {std::make_pair(44100u, 48000u), std::make_pair(48000u, 44100u)}) {
+    const unsigned int inRate = rates.first, outRate = rates.second;
+    const double ratio = static_cast<double>(outRate)/inRate;
+    auto filter = PolyphaseFilter::create(inRate, outRate, channels);
+    if (filter == nullptr) {
+      cout << "resampler: no polyphase filter for " << inRate << " Hz to " << outRate << " Hz" << endl;
+      return false;
+    }
+    auto polyphase = [&](const Wave &in) {
+      Resampler resampler(channels, filter);
+      return convert(in, ratio, period, [&](SRC_DATA &d) { return resampler.process(d); });
+    };
+    auto libsamplerate = [&](const Wave &in, int type) {
+      int error;
+      SRC_STATE_ptr src(src_new(type, channels, &error));
+      if (src == nullptr) {
+        throw std::runtime_error(src_strerror(error));
+      }
+      return convert(in, ratio, period, [&](SRC_DATA &d) { return src_process(src.get(), &d); });
+    };
+
+    double worst = 0.;
+    for(double freq : {1000., 15000.}) {
+      const auto in = sine(1., inRate, channels, freq);
+      const unsigned long skip = PolyphaseFilter::taps*4;
+      const double ours = snr(polyphase(in), channels, outRate, freq, skip);
+      const double best = snr(libsamplerate(in, SRC_SINC_BEST_QUALITY), channels, outRate, freq, skip);
+      const double fastest = snr(libsamplerate(in, SRC_SINC_FASTEST), channels, outRate, freq, skip);
+      cout << "resampler: " << inRate << " Hz to " << outRate << " Hz, " << freq << " Hz sine: SNR "
+           << ours << " dB polyphase, " << fastest << " dB SRC_SINC_FASTEST, "
+           << best << " dB SRC_SINC_BEST_QUALITY" << endl;
+      worst = std::min(worst, ours - fastest);
+    }
+
+    const auto in = sine(10., inRate, channels, 440.);
+    const double samples = in.samples.size()*ratio;
+    auto start = Clock::now();
+    polyphase(in);
+    const double ours = samples/since(start);
+    start = Clock::now();
+    libsamplerate(in, SRC_SINC_FASTEST);
+    const double fastest = samples/since(start);
+    cout << "resampler: " << inRate << " Hz to " << outRate << " Hz: " << ours/1e6
+         << " Msamples/s polyphase, " << fastest/1e6 << " Msamples/s SRC_SINC_FASTEST" << endl;
+    ok = ok && worst > -1. && ours > fastest;
+  }
+  cout << "resampler: " << (ok ? "ok" : "FAILED") << endl;
+  return ok;
+}
+
+/* The output stage of an export: PcmQuantizer on a stereo sine, in
+ * chunks of 4096 frames, in samples per second. Without noise shaping
+ * a sample must land within 1.5 LSB of the input: half an LSB of
+ * rounding and up to one of TPDF dither, give or take float rounding. */
+static bool benchQuantizer() {
+  const unsigned int channels = 2, chunk = 4096*channels;
+  const auto wave = sine(10., 48000, channels, 440.);
+  const auto &in = wave.samples;
+  vector<int32_t> out(in.size());
+  struct Format {
+    const char *name;
+    unsigned int bits;
+    bool noiseShaping;
+  };
+  const Format formats[] = {{"16 bit", 16, false}, {"16 bit, noise shaped", 16, true},
+                            {"24 bit", 24, false}};
+  bool ok = true;
+  for(auto &f : formats) {
+    PcmQuantizer quantizer(channels, f.bits, true, f.noiseShaping);
+    const auto start = Clock::now();
+    for(unsigned long done=0; done < in.size(); done += chunk) {
+      const auto n = std::min<unsigned long>(chunk, in.size() - done);
+      quantizer.convert(&in[done], n, &out[done]);
+    }
+    const double rate = in.size()/since(start);
+    double error = 0.;
+    const double scale = 1 << (f.bits - 1);
+    for(unsigned long i=0; i < in.size(); ++i) {
+      const double lsb = out[i]/static_cast<double>(1u << (32 - f.bits));
+      error = std::max(error, std::fabs(lsb - in[i]*scale));
+    }
+    const bool accurate = f.noiseShaping || error < 1.51;
+    cout << "quantizer: " << f.name << ", dithered: " << rate/1e6 << " Msamples/s, largest error "
+         << error << " LSB" << (accurate ? "" : " FAILED") << endl;
+    ok = ok && accurate;
+  }
+  return ok;
+}
+
+int runBench(const char *name) {
+  struct Bench {
+    const char *name;
+    bool (*run)();
+  };
+  const Bench benches[] = {
+    {"voices", benchVoices},
+    {"loop-seam", benchLoopSeam},
+    {"resampler", benchResampler},
+    {"quantizer", benchQuantizer},
+  };
+  bool found = false, ok = true;
+  for(auto &b : benches) {
+    if (!*name || !strcmp(name, b.name)) {
+      found = true;
+      ok = b.run() && ok;
+    }
+  }
+  if (!found) {
+    std::cerr << "No benchmark called " << name << endl;
+    return 2;
+  }
+  return ok ? 0 : 1;
+}
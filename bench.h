@@ -0,0 +1,21 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Benchmarks and checks of the engine, built with 'qmake CONFIG+=bench',
+ * which defines ENGINE_BENCH, and run without a GUI:
+ *
+ *   wavplayer --bench <name>
+ *
+ * voices: cost of a voice of the VoicePool per period, and whether
+ *         stealing a voice clicks
+ * loop-seam: discontinuity energy where a resampled loop wraps
+ * resampler: SNR and cost of the polyphase Resampler against
+ *            libsamplerate
+ * quantizer: samples per second of the dither and quantization of an
+ *            export, see PcmQuantizer
+ *
+ * Each prints its measurements and returns 0 if its checks passed; no
+ * name runs them all. */
+int runBench(const char *name);
+
+#endif
@@ -1,67 +1,159 @@
 #include "cutter.h"
 #include "jackplayer.h"
+#include "onsetdetector.h"
 #include "wave.h"
 #include "waveview.h"
 
-#include <sndfile.hh>
-
 #include <QObject>
 #include <QGraphicsItem>
+#include <QGraphicsSceneMouseEvent>
 #include <QMouseEvent>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
 #include <QMessageBox>
 
 #include <math.h>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <iterator>
 #include <stdexcept>
 
-class Cutter::Marker : public QObject, public QGraphicsPolygonItem {
-  Q_OBJECT
+// how far a cut may move to the nearest zero crossing, in seconds
+static const double snapDistance = 0.01;
+
+/* All the markers of the cuts in one item: a line down the view and a
+ * handle to drag it by at the top, the same size in pixels whatever the
+ * zoom. Only the cuts in the exposed rect are drawn, at most one per
+ * pixel column, and the handle under the mouse is found in
+ * Cutter::cuts, so neither depends on the number of cuts. */
+class Cutter::MarkerLayer : public QGraphicsItem {
 
 public:
-  Marker(QObject *parent = 0) : QObject(parent), QGraphicsPolygonItem() {};
+  MarkerLayer(Cutter *cutter, QRectF sceneRect) :
+    QGraphicsItem(), cutter(cutter), dragged(cutter->cuts.end()), grabOffset(0.),
+    sceneRect(sceneRect) {
+    pen.setColor(Qt::red);
+    pen.setCosmetic(true);
+    handle << QPointF(0,-5) << QPointF(0,15) << QPointF(handleWidth,-5) << QPointF(0,-5);
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setZValue(1.0);
+  };
 
-private:
+  // drop the cut being dragged, when the cuts are replaced under it
+  void cancelDrag() {
+    dragged = cutter->cuts.end();
+  };
 
-  QVariant itemChange(GraphicsItemChange change, const QVariant &value) {
-    qDebug() << __func__ ;
-    if (change == ItemScenePositionHasChanged) {
-      // value is the new position.
-      QPointF newPos = value.toPointF();
-      qDebug() << __func__ << "newPos: "  << newPos;
-      if(newPos.x() < 0) {
-        newPos.setX(0);
-      } else if (newPos.x() > scene()->width()) {
-        newPos.setX(scene()->width());
-      }
-      newPos.setY(0);
-      setPos(newPos);
-      emit positionChanged(static_cast<unsigned int>(newPos.x()));
-      return newPos;
-    } 
-    return QGraphicsPolygonItem::itemChange(change, value);
+  // the cut whose handle is at p, or cuts.end()
+  Cut cutAt(QPointF p) const {
+    auto &cuts = cutter->cuts;
+    const auto pixel = pixelSize();
+    if (p.y() < -5*pixel.height() || p.y() > 15*pixel.height()) {
+      return cuts.end();
+    }
+    // handles reach to the right of their cut: the last cut left of p
+    auto cut = p.x() < 0 ? cuts.begin() : cuts.upper_bound(p.x());
+    if (cut == cuts.begin()) {
+      return cuts.end();
+    }
+    --cut;
+    return (p.x() - *cut) <= handleWidth*pixel.width() ? cut : cuts.end();
   };
 
-signals:
-  void positionChanged(unsigned int pos);
-};
+  QRectF boundingRect() const {
+    // the handles are a few pixels wide and high at any zoom: a view
+    // around the wave is enough for them
+    return sceneRect.adjusted(0, -sceneRect.height(), sceneRect.width(), sceneRect.height());
+  };
 
-class Cutter::VerticalLine : public QGraphicsLineItem {
+  // only the handles take clicks, not the whole bounding rect
+  bool contains(const QPointF &point) const {
+    return cutAt(point) != cutter->cuts.end();
+  };
 
-public:
-  VerticalLine(QGraphicsItem *parentItem) : QGraphicsLineItem(parentItem) {};
-  
-  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
-    setLine(0, 0, 0, QPointF(0,scene()->views().first()->height()).y());
-    QGraphicsLineItem::paint(painter, option, widget);
+  bool collidesWithPath(const QPainterPath &path, Qt::ItemSelectionMode) const {
+    // the scene looks for items under a point with a 1x1 rect there
+    return contains(path.boundingRect().topLeft());
+  };
+
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *) {
+    const auto transform = painter->worldTransform();
+    const auto inverse = transform.inverted();
+
+    const auto &cuts = cutter->cuts;
+    const auto exposed = option->exposedRect;
+    auto cut = cuts.lower_bound(std::max(0., exposed.left() - handleWidth/transform.m11()));
+
+    // draw in pixels
+    painter->save();
+    painter->resetTransform();
+    painter->setPen(pen);
+    painter->setBrush(Qt::red);
+    const qreal bottom = painter->device()->height();
+    while (cut != cuts.end() && *cut <= exposed.right()) {
+      const auto p = transform.map(QPointF(*cut, 0));
+      painter->drawLine(p, QPointF(p.x(), bottom));
+      painter->drawPolygon(handle.translated(p));
+      // cuts closer than a pixel would be drawn on top of this one:
+      // skip to the next pixel column
+      cut = cuts.lower_bound(ceil(inverse.map(QPointF(floor(p.x()) + 1, 0)).x()));
+    }
+    painter->restore();
+  };
+
+protected:
+  void mousePressEvent(QGraphicsSceneMouseEvent *event) {
+    dragged = cutAt(event->pos());
+    if (dragged == cutter->cuts.end() || event->button() != Qt::LeftButton) {
+      dragged = cutter->cuts.end();
+      event->ignore();
+      return;
+    }
+    grabOffset = event->pos().x() - *dragged;
+  };
+
+  void mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
+    if (dragged != cutter->cuts.end()) {
+      const auto x = std::min(std::max(0., event->pos().x() - grabOffset), sceneRect.width());
+      dragged = cutter->moveCut(dragged, cutter->snap(x));
+    }
+  };
+
+  void mouseReleaseEvent(QGraphicsSceneMouseEvent *) {
+    if (dragged != cutter->cuts.end()) {
+      // one slice table per drag, not per mouse move
+      cutter->updateSlices();
+    }
+    dragged = cutter->cuts.end();
+  };
+
+private:
+  static constexpr qreal handleWidth = 13.3;
+
+  Cutter *cutter;
+  Cut dragged;
+  qreal grabOffset;
+  QRectF sceneRect;
+  QPen pen;
+  QPolygonF handle;
+
+  // size of a pixel in scene coordinates, at the zoom of the view now:
+  // a click may come before the first paint, or after a zoom that has
+  // not been painted yet
+  QSizeF pixelSize() const {
+    const auto transform = cutter->view->transform();
+    return QSizeF(1./transform.m11(), 1./transform.m22());
   };
 };
 
-#include "cutter.moc" // necessary to force moc to process this file's Q_OBJECT macros?
+constexpr qreal Cutter::MarkerLayer::handleWidth;
 
 Cutter::Cutter(QObject *parent, JackPlayer *p, WaveView *v) : 
-  QObject(parent), player(p), view(v), slice(nullptr), sliceStart(nullptr), sliceEnd(nullptr), toDelete(nullptr), deleteMenu(), selectionStart(0), selectionEnd(0) {
+  QObject(parent), player(p), view(v), slice(nullptr), layer(nullptr), cuts(), sliceStart(cuts.end()), sliceEnd(cuts.end()), toDelete(cuts.end()), deleteMenu(), grid(), selectionStart(0), selectionEnd(0) {
   auto deleteAction = new QAction("delete", &deleteMenu);
   deleteMenu.addAction(deleteAction);
   connect(deleteAction, SIGNAL(triggered()), this, SLOT(deleteMarker()) );
@@ -82,13 +174,11 @@ void Cutter::setView(WaveView *v) {
 void Cutter::handleMousePress(QMouseEvent *event) {
   auto scenePos = view->mapToScene(event->x(),event->y());
   auto button = event->button();
-  auto iAfter = std::find_if(cuts.begin(), cuts.end(), 
-                             [scenePos] (decltype(cuts[0]) a) 
-                             { return ( a->pos().x() > scenePos.x() );} );
+  auto iAfter = scenePos.x() < 0 ? cuts.begin() : cuts.upper_bound(scenePos.x());
 
-  auto clickedMarker = view->markerAt(event->pos());
-  if (clickedMarker && button == Qt::RightButton) {
-    toDelete = static_cast<Cutter::Marker*>(clickedMarker);
+  auto clickedMarker = layer ? layer->cutAt(scenePos) : cuts.end();
+  if (clickedMarker != cuts.end() && button == Qt::RightButton) {
+    toDelete = clickedMarker;
     deleteMenu.popup(QCursor::pos());
   } else if (button == Qt::RightButton) { // right click: show context menu
     addMenuPos = scenePos.x();
@@ -96,18 +186,18 @@ void Cutter::handleMousePress(QMouseEvent *event) {
   } else if (button == Qt::LeftButton) {
     if(event->modifiers() & Qt::ControlModifier) { // CTRL-click: add cut
       addCut(scenePos.x());
-    } else if (!clickedMarker 
+    } else if (clickedMarker == cuts.end()
                && iAfter != cuts.begin() && iAfter != cuts.end()) { // left click inside a slice
-      updateSlice(*(iAfter-1),*iAfter);
+      updateSlice(std::prev(iAfter), iAfter);
       playSlice();
     }
   }
 }
 
 void Cutter::drawSlice(void) {
-  if(sliceStart && sliceEnd) {
-    auto xStart = sliceStart->pos().x();
-    auto xEnd = sliceEnd->pos().x();
+  if(sliceStart != cuts.end() && sliceEnd != cuts.end()) {
+    qreal xStart = *sliceStart;
+    qreal xEnd = *sliceEnd;
     auto rect = QRectF(xStart, -5, xEnd-xStart,
                        10+ view->scene()->height() );
     if(slice) {
@@ -137,134 +227,160 @@ void Cutter::addCut(qreal scene_x) {
     // when clicked right of the wave, add a cut at the right:
     scene_x = view->scene()->width();
   }
-  auto i_insert = std::find_if(cuts.begin(), cuts.end(),
-                               [scene_x] (decltype(cuts[0]) a)
-                               { return (a->pos().x() >= scene_x );} );
+  const uint64_t pos = snap(scene_x);
   // if we already have a cut at that position, don't add another
-  if ( i_insert != cuts.end() 
-       && (*i_insert)->pos().x() == scene_x)
+  if (cuts.count(pos))
     return;
   
-  auto newMarker = addMarker(scene_x);
-  connect(static_cast<Marker *>(newMarker), SIGNAL(positionChanged(unsigned int)),
-          this, SLOT(markerMoved(unsigned int)) );
-  if (i_insert != cuts.end()) {
-    cuts.insert(i_insert, newMarker);
-  } else {
-    cuts.push_back(newMarker);
-  }
-  emit cutsChanged(cuts.size() > 1);
-  updateLoop();
-}
-
-Cutter::Marker *Cutter::addMarker(unsigned int pos) {
-  QPen pen;
-  pen.setColor(Qt::red);
-  pen.setCosmetic(true);
-
-  QPolygonF poly;
-  poly << QPointF(0,-5) << QPointF(0,15) << QPointF(13.3,-5) << QPointF(0,-5);
-  qDebug() << __func__ << "polygon closed?" << poly.isClosed();
-  auto p=new Marker(0);
-  p->setPen(pen);
-  p->setBrush(Qt::red);
-  p->setPolygon(poly);
-  p->setFlag(QGraphicsItem::ItemIsMovable);
-  p->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-  p->setFlag(QGraphicsItem::ItemSendsScenePositionChanges);
-  view->scene()->addItem(p);
-  p->setPos(pos,0);
-  p->setZValue(1.0);
-
-  auto line = new VerticalLine(p);
-  line->setPen(pen);
-
-  // check if we have created a new marker inside the active slice:
-  if(sliceStart && pos > sliceStart->pos().x()
-     && pos < sliceEnd ->pos().x() ) {
-    if ( (pos - sliceStart->pos().x())
-         < (sliceEnd->pos().x() - pos) ) {
-      // new marker is closer to sliceStart than to sliceEnd
+  auto cut = cuts.insert(pos);
+  layer->update();
+
+  // check if we have created a new cut inside the active slice:
+  if(sliceStart != cuts.end() && pos > *sliceStart
+     && pos < *sliceEnd ) {
+    if ( (pos - *sliceStart) < (*sliceEnd - pos) ) {
+      // new cut is closer to sliceStart than to sliceEnd
       // -> active slice is between Start and new
-      updateSlice(sliceStart, p);
+      updateSlice(sliceStart, cut);
     } else {
       // closer to sliceEnd -> active slice is between new and End
-      updateSlice(p, sliceEnd);
+      updateSlice(cut, sliceEnd);
     }
   }
 
-  return p;
+  emit cutsChanged(cuts.size() > 1);
+  updateLoop();
+  updateSlices();
+}
+
+/* The zero crossing nearest to scene_x where the slices start quietly,
+ * see ZeroCrossings. The ends of the wave stay where they are. */
+unsigned int Cutter::snap(qreal scene_x) const {
+  const unsigned int x = scene_x;
+  if (!crossings || x == 0 || x >= crossings->frames()) {
+    return x;
+  }
+  return crossings->snap(x, lround(snapDistance*wave->samplerate));
 }
 
 void Cutter::updateLoop(void) {
-  player->setLoopStart(0);
-  player->setLoopEnd(view->scene()->width());
+  unsigned int start, end;
+  loopRange(start, end);
+  player->setLoop(start, end);
+}
+
+/* Loop boundaries for the current loopState: the whole wave, unless we
+ * loop the selection or the slices, snapped to whole bars if we have a
+ * beat grid. */
+void Cutter::loopRange(unsigned int &start, unsigned int &end) const {
+  start = 0;
+  end = view->scene()->width();
 
   switch(loopState) {
   case Slices:
     if (cuts.size() >= 2) {
-      player->setLoopStart(cuts.front()->pos().x() );
-      player->setLoopEnd(cuts.back()->pos().x() );
+      start = *cuts.begin();
+      end = *cuts.rbegin();
     } 
     break;
   case Selection:
     if(selectionEnd > selectionStart) {
-      player->setLoopStart(selectionStart);
-      player->setLoopEnd(selectionEnd);
+      start = selectionStart;
+      end = selectionEnd;
     }
     break;
   default:
-    break;
+    // the whole wave
+    return;
+  }
+  if (grid.confident()) {
+    grid.snapLoop(start, end, view->scene()->width());
   }
 }
 
-void Cutter::markerMoved(unsigned int pos) {
-  std::sort(cuts.begin(), cuts.end(),
-            [] (QGraphicsItem *a, QGraphicsItem *b) { return a->pos().x() < b->pos().x(); });
+/* The regions between consecutive cuts */
+std::vector<std::pair<unsigned int, unsigned int> > Cutter::sliceRegions(void) const {
+  std::vector<std::pair<unsigned int, unsigned int> > regions;
+  for(auto iCut = cuts.begin(); iCut != cuts.end() && std::next(iCut) != cuts.end(); ++iCut) {
+    regions.push_back(std::make_pair(*iCut, *std::next(iCut)));
+  }
+  return regions;
+}
+
+/* Let MIDI notes play the slices, and have a stream keep the start of
+ * each one cached */
+void Cutter::updateSlices(void) {
+  player->setSlices(sliceRegions());
+  player->setCuePoints(std::vector<unsigned int>(cuts.begin(), cuts.end()));
+}
+
+/* Move cut to pos, while it is dragged; returns where it is now. The
+ * player gets the new slices once, when the drag ends, see
+ * MarkerLayer::mouseReleaseEvent(). */
+Cutter::Cut Cutter::moveCut(Cut cut, uint64_t pos) {
+  if (*cut == pos) {
+    return cut;
+  }
+  const bool wasStart = (cut == sliceStart);
+  const bool wasEnd = (cut == sliceEnd);
+  const bool wasToDelete = (cut == toDelete);
+  // re-key the cut, next to where it was: usually its place in the order
+  // doesn't change during a drag
+  auto hint = cuts.erase(cut);
+  auto moved = cuts.emplace_hint(hint, pos);
+  if (wasStart) {
+    sliceStart = moved;
+  } else if (wasEnd) {
+    sliceEnd = moved;
+  }
+  if (wasToDelete) {
+    toDelete = moved;
+  }
+  layer->update();
 
   updateLoop();
 
-  auto movedMarker = qobject_cast<Cutter::Marker *>(QObject::sender());
-  if(sliceStart) {
-    if (sliceStart->pos().x() > sliceEnd->pos().x()) {
+  if(sliceStart != cuts.end()) {
+    if (*sliceStart > *sliceEnd) {
       updateSlice(sliceEnd, sliceStart);
     }
-    // Check if one of the current sliceStart/End markers has moved,
-    // and rebuild the current slice around the marker which has *not*
+    // Check if one of the current sliceStart/End cuts has moved,
+    // and rebuild the current slice around the cut which has *not*
     // moved.
-    if(movedMarker == sliceStart) {
-      auto iMarker = std::find(cuts.begin(), cuts.end(), sliceEnd);
+    if(moved == sliceStart) {
+      auto iMarker = sliceEnd;
       if (iMarker == cuts.begin()) {
         ++iMarker;
       }
-      updateSlice(*(iMarker-1), *iMarker);
-    } else if(movedMarker == sliceEnd) {
-      auto iMarker = std::find(cuts.begin(), cuts.end(), sliceStart);
-      if (iMarker == (cuts.end()-1) ) {
+      updateSlice(std::prev(iMarker), iMarker);
+    } else if(moved == sliceEnd) {
+      auto iMarker = sliceStart;
+      if (std::next(iMarker) == cuts.end()) {
         --iMarker;
       }
-      updateSlice(*iMarker, *(1+iMarker));
-    } else if(pos > sliceStart->pos().x() && pos < sliceEnd->pos().x()) {
-      // third case: another marker was moved into the current slice.
-      // Rebuild the slice around the closest pair of markers.
-      if( (pos -sliceStart->pos().x()) < (sliceEnd->pos().x() - pos) ) {
+      updateSlice(iMarker, std::next(iMarker));
+    } else if(pos > *sliceStart && pos < *sliceEnd) {
+      // third case: another cut was moved into the current slice.
+      // Rebuild the slice around the closest pair of cuts.
+      if( (pos - *sliceStart) < (*sliceEnd - pos) ) {
         // new slice is closer to sliceStart -> make the slice between
         // sliceStart & new slice the active slice
-        updateSlice(sliceStart, movedMarker);
+        updateSlice(sliceStart, moved);
       } else {
         // new slice is closer to sliceEnd -> (new slice, sliceEnd)
         // becomes the active slice
-        updateSlice(movedMarker, sliceEnd);
+        updateSlice(moved, sliceEnd);
       }
     }
   }
+  return moved;
 }
 
 void Cutter::play() {
   if(selectionEnd > selectionStart) {
     // we have a selection, so play that
     player->play(selectionStart, selectionEnd);
-  } else if (sliceStart && sliceEnd) {
+  } else if (sliceStart != cuts.end() && sliceEnd != cuts.end()) {
     playSlice();
   } else {
     player->play();
@@ -272,39 +388,42 @@ void Cutter::play() {
 }
 
 void Cutter::playSlice(void) {
-  if(sliceStart && sliceEnd) {
-    player->play(sliceStart->pos().x(), sliceEnd->pos().x() );
+  if(sliceStart != cuts.end() && sliceEnd != cuts.end()) {
+    player->trigger(*sliceStart, *sliceEnd);
   }
 }
 
+void Cutter::playAllSlices(void) {
+  player->playRegions(sliceRegions());
+}
+
 void Cutter::nextSlice(void) {
-  if(sliceStart) {
-    auto current = std::find(cuts.begin(), cuts.end(), sliceStart);
+  if(sliceStart != cuts.end()) {
+    auto current = std::next(sliceStart);
     qDebug() << "cuts: " << cuts.size();
-    ++current;
-    if(current == cuts.end() || current == (cuts.end()-1) ) {
+    if(current == cuts.end() || std::next(current) == cuts.end()) {
       qDebug() << "at last cut, wraparound" ;
       current = cuts.begin();
     }
-    updateSlice(*current, *(1+current));
+    updateSlice(current, std::next(current));
   } else if (cuts.size() >= 2) {
     // if no slice is active, make the first slice the active one
-    updateSlice(cuts[0], cuts[1]);
+    updateSlice(cuts.begin(), std::next(cuts.begin()));
   }
   playSlice();
 }
 
 void Cutter::prevSlice(void) {
-  if(sliceStart) {
-    auto current = std::find(cuts.begin(), cuts.end(), sliceStart);
-    assert(current != cuts.end());
+  if(sliceStart != cuts.end()) {
+    auto current = sliceStart;
     if (current == cuts.begin()) {
-      current = --cuts.end();
+      current = std::prev(cuts.end());
     }
-    updateSlice(*(current-1), *current);
+    updateSlice(std::prev(current), current);
   } else if (cuts.size() >= 2) {
     // if no slice is active, make the last slice the active one
-    updateSlice( *(cuts.end() - 2), *(cuts.end() -1) );
+    auto last = std::prev(cuts.end());
+    updateSlice(std::prev(last), last);
   }
   playSlice();
 }
@@ -321,96 +440,237 @@ void Cutter::loop(void) {
   player->loop();
 }
 
-void Cutter::clear(void) {
+void Cutter::clear(std::shared_ptr<const Wave> w) {
   cuts.clear();
+  grid = BeatGrid();
+  crossings.reset(new ZeroCrossings(*w));
+  wave = std::move(w);
   emit cutsChanged(false); // there are no slices -> disable export
+  // the scene was cleared for the new wave, with our items
   slice = nullptr;
-  updateSlice(nullptr, nullptr);
+  layer = new MarkerLayer(this, view->scene()->sceneRect());
+  view->scene()->addItem(layer);
+  toDelete = cuts.end();
+  updateSlice(cuts.end(), cuts.end());
   loopState = None;
-  player->setLoopStart(0);
   qDebug() << __func__ << " set loop end to " << view->scene()->width();
-  player->setLoopEnd(view->scene()->width());
+  player->setLoop(0, view->scene()->width());
+  updateSlices();
+}
+
+/* The detectors take a while on a long wave, and use all cores, so they
+ * run on a thread of their own and the GUI polls finishAnalysis(). They
+ * share the wave, in case another one is loaded meanwhile. */
+void Cutter::detectOnsets(double sensitivity) {
+  if (analysing())
+    return;
+  auto w = wave;
+  onsets = std::async(std::launch::async, [w, sensitivity]() {
+    return OnsetDetector(*w).detect(sensitivity);
+  });
+}
+
+void Cutter::detectBeats(GridStep step) {
+  if (analysing())
+    return;
+  auto w = wave;
+  beatStep = step;
+  beats = std::async(std::launch::async, [w]() {
+    return BeatTracker(*w).estimate();
+  });
+}
+
+bool Cutter::analysing() const {
+  return onsets.valid() || beats.valid();
+}
+
+bool Cutter::finishAnalysis() {
+  const auto ready = std::chrono::seconds(0);
+  if (onsets.valid()) {
+    if (onsets.wait_for(ready) != std::future_status::ready)
+      return false;
+    setCuts(onsets.get());
+    return true;
+  }
+  if (beats.valid()) {
+    if (beats.wait_for(ready) != std::future_status::ready)
+      return false;
+    grid = beats.get();
+    // Beats, Eighths, Sixteenths: halving the step each time
+    const double step = (beatStep == Bars) ? grid.beatsPerBar : 1./(1 << (beatStep - Beats));
+    setCuts(grid.lines(view->scene()->width(), step));
+    return true;
+  }
+  return false;
+}
+
+/* The slice points of other tools mark where slices start, so the file
+ * starts the first one. They were placed by hand or by a tool that
+ * knew the audio better than a zero crossing does: keep them as they
+ * are. */
+void Cutter::importCuts(const std::vector<unsigned int> &frames) {
+  std::vector<unsigned int> withStart;
+  if (frames.empty() || frames.front() > 0) {
+    withStart.push_back(0);
+  }
+  withStart.insert(withStart.end(), frames.begin(), frames.end());
+  setCuts(withStart, false);
+}
+
+/* Replace all cuts with cuts at frames, ascending, and one at the end;
+ * snapped: to the nearest zero crossing */
+void Cutter::setCuts(const std::vector<unsigned int> &frames, bool snapped) {
+  // analysis results can come in during a drag, or with the delete menu
+  // open: neither may keep a cut that is gone
+  if (layer) {
+    layer->cancelDrag();
+  }
+  toDelete = cuts.end();
+  cuts.clear();
+  updateSlice(cuts.end(), cuts.end());
+
+  // add the cuts in one go, and update the player and the view once
+  for(auto frame : frames) {
+    cuts.emplace_hint(cuts.end(), snapped ? snap(frame) : frame);
+  }
+  const unsigned int end = view->scene()->width();
+  if (cuts.empty() || *cuts.rbegin() < end) {
+    cuts.emplace_hint(cuts.end(), end);
+  }
+  layer->update();
+  emit cutsChanged(cuts.size() > 1);
+  updateLoop();
+  updateSlices();
 }
 
 void Cutter::deleteMarker() {
-  assert(toDelete);
-  auto iMarker = std::find(cuts.begin(), cuts.end(), toDelete);
+  if (toDelete == cuts.end()) {
+    // the cuts were replaced while the menu was open
+    return;
+  }
+  auto iMarker = toDelete;
   if(toDelete == sliceStart) {
     if(iMarker != cuts.begin()) {
-      updateSlice(*(iMarker -1), sliceEnd);
+      updateSlice(std::prev(iMarker), sliceEnd);
     } else {
-      updateSlice(nullptr, nullptr);
+      updateSlice(cuts.end(), cuts.end());
     }
   } else if (toDelete == sliceEnd) {
-    if( (iMarker + 1) != cuts.end() ) {
-      updateSlice(sliceStart, *(iMarker+1));
+    if(std::next(iMarker) != cuts.end()) {
+      updateSlice(sliceStart, std::next(iMarker));
     } else {
-      updateSlice(nullptr, nullptr);
+      updateSlice(cuts.end(), cuts.end());
     }
   }
   cuts.erase(iMarker);
+  toDelete = cuts.end();
+  layer->update();
   emit cutsChanged(cuts.size() > 1);
 
   updateLoop();
-
-  delete toDelete;
-  toDelete = nullptr;
+  updateSlices();
 }
 
-inline void Cutter::updateSlice(Marker *start, Marker *end) {
+inline void Cutter::updateSlice(Cut start, Cut end) {
   sliceStart = start;
   sliceEnd = end;
   drawSlice();
 }
 
-void Cutter::exportSamples(const QString& path) const {
+std::unique_ptr<SliceExporter> Cutter::exportSamples(const QString& path, const ExportFormat &format) const {
   assert(cuts.size() > 1); // need at least one slice to export -> minimum of 2 cuts
 
-  // soundfile parameters are the same for each slice:
-  const int format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
-  const int sampleRate = 44100;
-  const Wave& wave = player->getCurWave();
-
   // decimals needed for the number of cuts: 1 + log10(number of slices)
   unsigned int nDecimals = 1+floor(log10(cuts.size()-1));
 
+  std::vector<ExportJob> jobs;
   unsigned int nWaves=1;
-  bool overwriteAll = false;
-  for(auto iCut = cuts.begin(); (1+iCut) != cuts.end();++iCut) {
-    unsigned int start = (*iCut)->x();
-    unsigned int end = (*(1+iCut))->x();
+  std::vector<bool> exists;
+  for(auto iCut = cuts.begin(); std::next(iCut) != cuts.end();++iCut) {
     auto fileName = path + QString("%1.wav").arg(nWaves++, nDecimals, 10, QChar('0'));
+    jobs.push_back(ExportJob{fileName.toLocal8Bit().constData(),
+          static_cast<unsigned int>(*iCut), static_cast<unsigned int>(*std::next(iCut))});
+    exists.push_back(QFile::exists(fileName));
+  }
 
-    if(QFile::exists(fileName) && !overwriteAll) {
-      QMessageBox askOverwrite(QMessageBox::Question,
-                               "Overwrite existing file?",
-                               "A file named " + fileName + " already exists. Do you want to replace it?",
-                               QMessageBox::Yes | QMessageBox::YesToAll | QMessageBox::No | QMessageBox::NoToAll);
-      askOverwrite.setDefaultButton(QMessageBox::NoToAll);
-      switch (askOverwrite.exec()) {
-      case QMessageBox::Yes:
-        break;
-      case QMessageBox::YesToAll:
-        overwriteAll = true;
-        break;
-      case QMessageBox::No:
-        continue;
-        break;
-      case QMessageBox::NoToAll:
-        return; 
-        break;
+  // decide about existing files once, before anything is written
+  const auto nExisting = std::count(exists.begin(), exists.end(), true);
+  if (nExisting) {
+    QMessageBox askOverwrite(QMessageBox::Question,
+                             "Overwrite existing files?",
+                             QString("%1 of the %2 files already exist. Do you want to replace them?")
+                             .arg(nExisting).arg(jobs.size()),
+                             QMessageBox::YesToAll | QMessageBox::NoToAll | QMessageBox::Cancel);
+    askOverwrite.setButtonText(QMessageBox::NoToAll, "Skip Existing");
+    askOverwrite.setDefaultButton(QMessageBox::Cancel);
+    switch (askOverwrite.exec()) {
+    case QMessageBox::YesToAll:
+      break;
+    case QMessageBox::NoToAll: {
+      std::vector<ExportJob> newJobs;
+      for(unsigned int i=0; i < jobs.size(); ++i) {
+        if (!exists[i]) {
+          newJobs.push_back(jobs[i]);
+        }
       }
+      jobs.swap(newJobs);
+      break;
+    }
+    default:
+      return nullptr;
     }
+  }
 
-    SndfileHandle outFile(fileName.toLatin1().constData(), SFM_WRITE,
-                          format, wave.channels, sampleRate);
-    if (!outFile) {
-      auto errMsg =  ("Error opening file " + fileName).toLatin1().constData();
-      throw std::runtime_error(errMsg);
+  std::unique_ptr<SliceExporter> exporter(new SliceExporter(*wave, format));
+  exporter->start(std::move(jobs));
+  return exporter;
+}
+
+std::unique_ptr<SliceExporter> Cutter::exportSampleMap(const QString& fileName, const ExportFormat &format) const {
+  assert(cuts.size() > 1);
+  const auto &wave = *this->wave;
+
+  auto base = fileName;
+  if (base.endsWith(".wav", Qt::CaseInsensitive)) {
+    base.chop(4);
+  }
+  QStringList names;
+  names << base + ".wav" << base + ".sfz" << base + ".json";
+  QStringList existing;
+  for(auto &name : names) {
+    if (QFile::exists(name)) {
+      existing << QFileInfo(name).fileName();
     }
-    outFile.writef(&wave.samples[start*wave.channels], end-start);
   }
-  
+  if (!existing.isEmpty() &&
+      QMessageBox::question(0, "Overwrite existing files?",
+                            QString("%1 already exist. Do you want to replace them?")
+                            .arg(existing.join(", ")),
+                            QMessageBox::Yes | QMessageBox::Cancel) != QMessageBox::Yes) {
+    return nullptr;
+  }
+
+  ExportJob job{names[0].toLocal8Bit().constData(),
+      0, static_cast<unsigned int>(wave.samples.size() / wave.channels)};
+  job.cues.assign(cuts.begin(), cuts.end());
+  job.sfzName = names[1].toLocal8Bit().constData();
+  job.jsonName = names[2].toLocal8Bit().constData();
+
+  std::unique_ptr<SliceExporter> exporter(new SliceExporter(wave, format));
+  exporter->start({job});
+  return exporter;
+}
+
+RenderResult Cutter::renderLoop(const QString& fileName, unsigned int repeats) const {
+  unsigned int start, end;
+  loopRange(start, end);
+  return Renderer(wave).renderLoop(fileName.toLocal8Bit().constData(),
+                                   start, end, repeats);
+}
+
+RenderResult Cutter::renderSlices(const QString& fileName) const {
+  return Renderer(wave).renderRegions(fileName.toLocal8Bit().constData(),
+                                      sliceRegions());
 }
 
 void Cutter::selectRange(unsigned int selectionStart, unsigned int selectionEnd) {
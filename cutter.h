@@ -4,46 +4,105 @@
 #include <QObject>
 #include <QMenu>
 
+#include <cstdint>
+#include <future>
+#include <set>
+#include <memory>
 #include <vector>
 
+#include "beattracker.h"
+#include "renderer.h"
+#include "sliceexporter.h"
+#include "zerocrossings.h"
+
 class WaveView;
 class QGraphicsItem;
 class QGraphicsRectItem;
 class QMouseEvent;
 class JackPlayer;
+class Wave;
 
 class Cutter :public QObject {
   Q_OBJECT
 
   public:
+  enum GridStep { Bars, Beats, Eighths, Sixteenths };
+
   Cutter(QObject *parent=0, JackPlayer *p=0, WaveView *v=0);
 
   void setView(WaveView *v);
-  void clear(void);
+  // start over on w, the wave the player was just given
+  void clear(std::shared_ptr<const Wave> w);
   void loop(void);
+  // start finding the onsets in the wave on a thread of its own, see
+  // OnsetDetector; finishAnalysis() then replaces the cuts with one at
+  // each onset, and one at the end
+  void detectOnsets(double sensitivity);
+  // the same for the lines of the beat grid of the wave, see
+  // BeatTracker; when the grid is confident, loops snap to whole bars
+  void detectBeats(GridStep step);
+  // an analysis is running, and reading the wave
+  bool analysing() const;
+  // if the analysis is done, replace the cuts with its result and
+  // return true; rethrows what it threw
+  bool finishAnalysis();
+  const BeatGrid &beatGrid() const { return grid; }
+  // replace the cuts with ones stored with the file, see
+  // SoundFileHandler::read(), at exactly those frames
+  void importCuts(const std::vector<unsigned int> &frames);
 
-  void exportSamples(const QString& path) const;
+  // start writing the slices to path01.wav, path02.wav... in the
+  // background, see SliceExporter. Asks once what to do about existing
+  // files; null if the user cancelled.
+  std::unique_ptr<SliceExporter> exportSamples(const QString& path, const ExportFormat &format) const;
+  // start writing the whole wave to one WAV file with a cue point at
+  // each cut, and an SFZ and JSON slice map next to it; see SampleMap.
+  // Null if the user would not overwrite.
+  std::unique_ptr<SliceExporter> exportSampleMap(const QString& fileName, const ExportFormat &format) const;
+  // bounce the current loop 'repeats' times, or all slices in order
+  RenderResult renderLoop(const QString& fileName, unsigned int repeats) const;
+  RenderResult renderSlices(const QString& fileName) const;
 
 private:
   enum LoopState { None, Selection, Slices};
-  class Marker;
-  class VerticalLine;
+  class MarkerLayer;
+  // the cuts by sample position, so that finding the neighbours of
+  // a position, adding, moving and deleting a cut are all O(log n).
+  // A Cut stays valid until its cut is moved or deleted; cuts.end()
+  // is no cut.
+  typedef std::multiset<uint64_t> CutIndex;
+  typedef CutIndex::iterator Cut;
   JackPlayer *player;
+  // what the player plays from the next period on; ours to read on
+  // the GUI thread
+  std::shared_ptr<const Wave> wave;
   WaveView *view;
   QGraphicsRectItem *slice;
-  Marker *sliceStart;
-  Marker *sliceEnd;
-  Marker *toDelete;
+  MarkerLayer *layer; // draws the cuts
+  CutIndex cuts;
+  Cut sliceStart;
+  Cut sliceEnd;
+  Cut toDelete;
   QMenu deleteMenu;
   QMenu addMenu;
-  std::vector<Marker *> cuts;
-  Marker *addMarker(unsigned int pos);
   void addCut(qreal scene_x);
+  Cut moveCut(Cut cut, uint64_t pos);
   LoopState loopState;
+  BeatGrid grid; // of the current wave, if detected
+  // the analysis running in the background, if any
+  std::future<std::vector<unsigned int> > onsets;
+  std::future<BeatGrid> beats;
+  GridStep beatStep;
+  std::unique_ptr<ZeroCrossings> crossings; // of the current wave
 
-  void updateSlice(Marker *start, Marker *end);
+  unsigned int snap(qreal scene_x) const;
+  void updateSlice(Cut start, Cut end);
   void drawSlice(void);
   void updateLoop(void);
+  void loopRange(unsigned int &start, unsigned int &end) const;
+  std::vector<std::pair<unsigned int, unsigned int> > sliceRegions() const;
+  void updateSlices(void);
+  void setCuts(const std::vector<unsigned int> &frames, bool snapped=true);
   void playSlice(void);
   unsigned int selectionStart;
   unsigned int selectionEnd;
@@ -54,11 +113,12 @@ public slots:
   void nextSlice(void);
   void prevSlice(void);
   void play(void);
+  // play all slices in order, back to back
+  void playAllSlices(void);
   void selectRange(unsigned int, unsigned int);
   void addCut();
 
 private slots:
-  void markerMoved(unsigned int newPos);
   void deleteMarker();
 
 signals:
@@ -0,0 +1,320 @@
+#include "diskstream.h"
+
+#include <sndfile.hh>
+#include <mpg123.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+// frames decoded per iteration of the I/O thread
+static const unsigned long chunkFrames = 4096;
+
+/* Sequential reader with seeking, for the I/O thread. */
+class StreamDecoder {
+
+public:
+  virtual ~StreamDecoder() {};
+
+  virtual unsigned int channels() const = 0;
+  virtual unsigned int samplerate() const = 0;
+  virtual unsigned long frames() const = 0;
+  virtual void seek(unsigned long frame) = 0;
+  virtual unsigned long read(float *out, unsigned long frames) = 0;
+};
+
+class SndfileDecoder : public StreamDecoder {
+
+public:
+  SndfileDecoder(const string &fileName) : handle(fileName.c_str()) {};
+
+  bool ok() const { return handle && handle.frames() > 0; }
+
+  unsigned int channels() const { return handle.channels(); }
+  unsigned int samplerate() const { return handle.samplerate(); }
+  unsigned long frames() const { return handle.frames(); }
+  void seek(unsigned long frame) { handle.seek(frame, SEEK_SET); }
+  unsigned long read(float *out, unsigned long frames) { return handle.readf(out, frames); }
+
+private:
+  SndfileHandle handle;
+};
+
+class Mpg123Decoder : public StreamDecoder {
+
+public:
+  Mpg123Decoder(const string &fileName) : handle(nullptr), nChannels(0), rate(0), length(0) {
+    int err;
+    handle = mpg123_new(NULL, &err);
+    if (handle == NULL) {
+      throw std::runtime_error("Can't allocate mpg123 handle.");
+    }
+    mpg123_param(handle, MPG123_ADD_FLAGS, MPG123_FORCE_FLOAT, 0.);
+
+    int channels, encoding;
+    long r;
+    if (mpg123_open(handle, fileName.c_str()) != MPG123_OK
+        || mpg123_getformat(handle, &r, &channels, &encoding) != MPG123_OK ) {
+      string msg = string("mpg123 error: ") + mpg123_strerror(handle);
+      mpg123_delete(handle);
+      throw std::runtime_error(msg);
+    }
+    mpg123_format_none(handle);
+    mpg123_format(handle, r, channels, encoding);
+    // scan the file for an exact length
+    mpg123_scan(handle);
+
+    nChannels = channels;
+    rate = r;
+    auto l = mpg123_length(handle);
+    length = l > 0 ? l : 0;
+  }
+
+  ~Mpg123Decoder() {
+    mpg123_close(handle);
+    mpg123_delete(handle);
+  }
+
+  unsigned int channels() const { return nChannels; }
+  unsigned int samplerate() const { return rate; }
+  unsigned long frames() const { return length; }
+  void seek(unsigned long frame) { mpg123_seek(handle, frame, SEEK_SET); }
+
+  unsigned long read(float *out, unsigned long frames) {
+    size_t done = 0;
+    auto err = mpg123_read(handle, reinterpret_cast<unsigned char*>(out),
+                           frames*nChannels*sizeof(float), &done);
+    if (err != MPG123_OK && err != MPG123_DONE && err != MPG123_NEED_MORE) {
+      return 0;
+    }
+    return done/(nChannels*sizeof(float));
+  }
+
+private:
+  mpg123_handle *handle;
+  unsigned int nChannels;
+  unsigned int rate;
+  unsigned long length;
+};
+
+/* Open fileName with libsndfile, or as mp3 if libsndfile can't read
+ * it, like SoundFileHandler::read. */
+static unique_ptr<StreamDecoder> openDecoder(const string &fileName) {
+  unique_ptr<SndfileDecoder> sndfile(new SndfileDecoder(fileName));
+  if (sndfile->ok()) {
+    return std::move(sndfile);
+  }
+  return unique_ptr<StreamDecoder>(new Mpg123Decoder(fileName));
+}
+
+DiskStream::DiskStream(const string &fileName, double bufferSeconds, double headSeconds) :
+  decoder(openDecoder(fileName)),
+  nChannels(decoder->channels()),
+  rate(decoder->samplerate()),
+  length(decoder->frames()),
+  headFrames(headSeconds*rate),
+  ring(std::max<size_t>(bufferSeconds*rate, chunkFrames) * nChannels),
+  running(true),
+  seekTarget(0), seekGeneration(0), seekDone(0), flushUntil(0),
+  pushed(0), popped(0),
+  cuesChanged(false),
+  heads(new HeadCache()),
+  headData(nullptr), headLeft(0), readPos(0) {
+  if (!nChannels) {
+    throw std::runtime_error("Can't stream " + fileName);
+  }
+  ioThread = std::thread(&DiskStream::run, this);
+}
+
+DiskStream::~DiskStream(void) {
+  running = false;
+  ioThread.join();
+
+  unique_ptr<HeadCache> h;
+  while (headIn.pop(h) || headOut.pop(h) ) {
+    h.reset();
+  }
+}
+
+void DiskStream::setCuePoints(vector<unsigned long> cues) {
+  std::lock_guard<std::mutex> lock(cueMutex);
+  cueRequest = std::move(cues);
+  cuesChanged = true;
+}
+
+/* I/O thread: handle seeks and cue point requests, and keep the ring
+ * buffer filled. */
+void DiskStream::run(void) {
+  vector<float> chunk(chunkFrames*nChannels);
+  size_t chunkFill = 0, chunkOffset = 0; // samples
+  unsigned long streamPos = 0; // frame after the last one decoded
+  unsigned int generation = 0;
+  HeadCache published; // copy of the heads we last sent to process()
+
+  while (running) {
+    bool idle = true;
+
+    // free the head caches that process() has replaced
+    unique_ptr<HeadCache> oldHeads;
+    while (headOut.pop(oldHeads) ) {
+      oldHeads.reset();
+    }
+
+    vector<unsigned long> cues;
+    bool newCues = false;
+    {
+      std::lock_guard<std::mutex> lock(cueMutex);
+      if (cuesChanged && headIn.write_available()) {
+        cues.swap(cueRequest);
+        cuesChanged = false;
+        newCues = true;
+      }
+    }
+    if (newCues) {
+      buildHeads(std::move(cues), published);
+      headIn.push(unique_ptr<HeadCache>(new HeadCache(published)));
+      // continue streaming where we were
+      decoder->seek(streamPos);
+      idle = false;
+    }
+
+    auto g = seekGeneration.load(std::memory_order_acquire);
+    if (g != generation) {
+      streamPos = std::min(seekTarget.load(std::memory_order_relaxed), length);
+      decoder->seek(streamPos);
+      chunkFill = chunkOffset = 0;
+      flushUntil.store(pushed, std::memory_order_relaxed);
+      seekDone.store(g, std::memory_order_release);
+      generation = g;
+    }
+
+    if (chunkOffset == chunkFill) {
+      auto n = decoder->read(chunk.data(), chunkFrames);
+      streamPos += n;
+      chunkFill = n*nChannels;
+      chunkOffset = 0;
+    }
+    if (chunkOffset < chunkFill) {
+      auto n = ring.push(&chunk[chunkOffset], chunkFill - chunkOffset);
+      chunkOffset += n;
+      pushed += n;
+      idle = idle && !n;
+    }
+
+    if (idle) {
+      // ring buffer full, or end of file
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+  }
+}
+
+/* I/O thread: make 'current' hold the heads for 'cues', decoding only
+ * the ones we don't have yet. */
+void DiskStream::buildHeads(vector<unsigned long> cues, HeadCache &current) {
+  std::sort(cues.begin(), cues.end());
+  cues.erase(std::unique(cues.begin(), cues.end()), cues.end());
+
+  HeadCache result;
+  result.reserve(cues.size());
+  auto iOld = current.begin();
+  for(auto frame : cues) {
+    if (frame >= length) {
+      break;
+    }
+    iOld = std::lower_bound(iOld, current.end(), frame,
+                            [] (const Head &h, unsigned long f) { return h.frame < f; });
+    Head head;
+    head.frame = frame;
+    if (iOld != current.end() && iOld->frame == frame) {
+      head.samples = iOld->samples;
+    } else {
+      auto samples = std::make_shared<vector<float> >(headFrames*nChannels);
+      decoder->seek(frame);
+      auto n = decoder->read(samples->data(), headFrames);
+      samples->resize(n*nChannels);
+      head.samples = samples;
+    }
+    result.push_back(head);
+  }
+  current.swap(result);
+}
+
+/* Process thread: switch to the newest head cache, unless we are still
+ * playing from the old one. */
+void DiskStream::updateHeads(void) {
+  if (headLeft) {
+    return;
+  }
+  if (headsPending == nullptr) {
+    headIn.pop(headsPending);
+  }
+  if (headsPending != nullptr && headOut.push(std::move(heads)) ) {
+    heads = std::move(headsPending);
+  }
+}
+
+void DiskStream::seek(unsigned long frame) {
+  headLeft = 0;
+  updateHeads();
+
+  frame = std::min(frame, length);
+  readPos = frame;
+
+  auto iHead = std::lower_bound(heads->begin(), heads->end(), frame,
+                                [] (const Head &h, unsigned long f) { return h.frame < f; });
+  unsigned long streamFrom = frame;
+  if (iHead != heads->end() && iHead->frame == frame) {
+    headData = iHead->samples->data();
+    headLeft = iHead->samples->size()/nChannels;
+    streamFrom += headLeft;
+  }
+
+  seekTarget.store(streamFrom, std::memory_order_relaxed);
+  seekGeneration.store(seekGeneration.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+}
+
+unsigned int DiskStream::read(float *out, unsigned int frames) {
+  updateHeads();
+
+  unsigned int done = 0;
+  if (headLeft) {
+    done = std::min<unsigned long>(headLeft, frames);
+    std::copy(headData, headData + done*nChannels, out);
+    headData += done*nChannels;
+    headLeft -= done;
+  }
+
+  if (done < frames) {
+    // Drop what the I/O thread read ahead before the last seek. Until it
+    // acknowledges the seek, all that is in the ring is stale, so the
+    // I/O thread gets room to refill as soon as it has seeked.
+    const auto available = ring.read_available();
+    const bool seeking = seekDone.load(std::memory_order_acquire)
+      != seekGeneration.load(std::memory_order_relaxed);
+    const auto stale = seeking ? popped + available : flushUntil.load(std::memory_order_relaxed);
+    while (popped < stale) {
+      auto n = ring.pop(out + done*nChannels,
+                        std::min<unsigned long>(stale - popped, (frames - done)*nChannels));
+      if (!n) {
+        break;
+      }
+      popped += n;
+    }
+    if (!seeking && popped >= stale) {
+      // only pop whole frames
+      auto n = ring.pop(out + done*nChannels,
+                        std::min<unsigned long>(ring.read_available() / nChannels, frames - done) * nChannels);
+      popped += n;
+      done += n/nChannels;
+    }
+  }
+
+  readPos += done;
+  return done;
+}
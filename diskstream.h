@@ -0,0 +1,98 @@
+#ifndef DISKSTREAM_H
+#define DISKSTREAM_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef Q_MOC_RUN // moc can't handle some boost macro's
+#include "spsc_queue.hpp"
+#endif
+
+class StreamDecoder;
+
+/* Plays a sound file from disk without decoding it up front. An I/O
+ * thread decodes ahead of the play position into a lock-free ring
+ * buffer, which the process thread consumes with read().
+ *
+ * seek() is served from the ring buffer once the I/O thread has
+ * caught up, which takes a while. For the cue points (loop and slice
+ * starts), the first headSeconds are kept in memory, so that playback
+ * can start from them immediately while the I/O thread seeks. */
+class DiskStream {
+
+public:
+  DiskStream(const std::string &fileName, double bufferSeconds=2., double headSeconds=0.25);
+  ~DiskStream();
+
+  unsigned int channels() const { return nChannels; }
+  unsigned int samplerate() const { return rate; }
+  unsigned long frames() const { return length; }
+
+  // Cache the start of the stream at each of these frames. Can be
+  // called from any thread but the process thread; only the last
+  // request is handled if they come in faster than the I/O thread
+  // can decode them.
+  void setCuePoints(std::vector<unsigned long> cues);
+
+  // process thread only: continue reading at 'frame'
+  void seek(unsigned long frame);
+  // process thread only: read up to 'frames' interleaved frames,
+  // returns the number of frames read, which is less than requested
+  // when the I/O thread can't keep up or at the end of the file.
+  unsigned int read(float *out, unsigned int frames);
+  // process thread only: frame that the next read() starts at
+  unsigned long position() const { return readPos; }
+
+private:
+  struct Head {
+    unsigned long frame;
+    std::shared_ptr<const std::vector<float> > samples;
+  };
+  typedef std::vector<Head> HeadCache; // sorted on frame
+  typedef boost::lockfree::spsc_queue<std::unique_ptr<HeadCache>, boost::lockfree::capacity<4> > spsc_head_queue;
+
+  std::unique_ptr<StreamDecoder> decoder; // used by the I/O thread only
+  unsigned int nChannels;
+  unsigned int rate;
+  unsigned long length;
+  unsigned long headFrames;
+
+  boost::lockfree::spsc_queue<float> ring;
+  std::thread ioThread;
+  std::atomic<bool> running;
+
+  // seek requests: process() sets seekTarget, then bumps
+  // seekGeneration. The I/O thread seeks, stores in flushUntil how
+  // many samples it had pushed before the seek, and acknowledges by
+  // setting seekDone to the generation.
+  std::atomic<unsigned long> seekTarget;
+  std::atomic<unsigned int> seekGeneration;
+  std::atomic<unsigned int> seekDone;
+  std::atomic<unsigned long> flushUntil;
+  unsigned long pushed; // I/O thread: samples pushed onto ring
+  unsigned long popped; // process thread: samples popped from ring
+
+  // head caches: built by the I/O thread, retired by process()
+  spsc_head_queue headIn;
+  spsc_head_queue headOut;
+  std::mutex cueMutex;
+  std::vector<unsigned long> cueRequest;
+  bool cuesChanged;
+
+  // process thread state
+  std::unique_ptr<HeadCache> heads;
+  std::unique_ptr<HeadCache> headsPending;
+  const float *headData;
+  unsigned long headLeft; // frames
+  unsigned long readPos;
+
+  void run();
+  void buildHeads(std::vector<unsigned long> cues, HeadCache &current);
+  void updateHeads();
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "jackbackend.h"
+
+#include <jack/midiport.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+using std::cerr;
+using std::endl;
+
+JackBackend::JackBackend(const char *clientName) : audioClient(nullptr), midiPort(nullptr), active(false) {
+  client = jack_client_open(clientName, JackNullOption, 0 , 0);
+  if (client == nullptr) {
+    cerr << __func__ << " client failed!" << endl;
+  }
+  outputPorts.fill(nullptr);
+}
+
+JackBackend::~JackBackend(void) {
+  if (client) {
+    deactivate();
+    jack_client_close(client);
+  }
+}
+
+bool JackBackend::open(AudioClient *c) {
+  audioClient = c;
+  return client != nullptr
+    && jack_set_process_callback( client, process_wrap, this ) == 0
+    && jack_set_buffer_size_callback( client, bufsize_wrap, this ) == 0;
+}
+
+void JackBackend::activate(void) {
+  if (client && !active) {
+    active = (jack_activate(client) == 0);
+  }
+}
+
+void JackBackend::deactivate(void) {
+  if (client && active) {
+    jack_deactivate(client);
+    active = false;
+  }
+}
+
+unsigned int JackBackend::sampleRate(void) const {
+  return client ? jack_get_sample_rate(client) : 0;
+}
+
+unsigned int JackBackend::bufferSize(void) const {
+  return client ? jack_get_buffer_size(client) : 0;
+}
+
+/* Register output port 'index' and connect it to the matching system
+ * playback port. */
+bool JackBackend::addOutput(unsigned int index) {
+  if (!client || index >= outputPorts.size()) {
+    return false;
+  }
+  auto name = "output" + std::to_string(index+1);
+  auto port = jack_port_register (client,
+                                  name.c_str(),
+                                  JACK_DEFAULT_AUDIO_TYPE,
+                                  JackPortIsOutput,
+                                  0);
+  if (port == nullptr) {
+    cerr << __func__ << ": can't register port " << name << endl;
+    return false;
+  }
+  outputPorts[index] = port;
+
+  auto playback = "system:playback_" + std::to_string(index+1);
+  jack_connect(client, jack_port_name(port), playback.c_str());
+  return true;
+}
+
+float *JackBackend::outputBuffer(unsigned int index, unsigned int nframes) {
+  return static_cast<float*>(jack_port_get_buffer(outputPorts[index], nframes));
+}
+
+bool JackBackend::addMidiInput(void) {
+  if (!client) {
+    return false;
+  }
+  if (midiPort.load() != nullptr) {
+    return true;
+  }
+  auto port = jack_port_register (client,
+                                  "midi_in",
+                                  JACK_DEFAULT_MIDI_TYPE,
+                                  JackPortIsInput,
+                                  0);
+  if (port == nullptr) {
+    cerr << __func__ << ": can't register MIDI port" << endl;
+    return false;
+  }
+  midiPort.store(port, std::memory_order_release);
+  return true;
+}
+
+unsigned int JackBackend::midiEvents(unsigned int nframes, MidiEvent *events, unsigned int max) {
+  auto port = midiPort.load(std::memory_order_acquire);
+  if (port == nullptr) {
+    return 0;
+  }
+  auto buffer = jack_port_get_buffer(port, nframes);
+  const auto count = jack_midi_get_event_count(buffer);
+  unsigned int n = 0;
+  for(uint32_t i=0; i < count && n < max; ++i) {
+    jack_midi_event_t event;
+    if (jack_midi_event_get(&event, buffer, i) != 0
+        || event.size == 0 || event.size > sizeof(events[n].data) ) {
+      continue;
+    }
+    events[n].frame = event.time;
+    events[n].size = event.size;
+    std::copy(event.buffer, event.buffer + event.size, events[n].data);
+    ++n;
+  }
+  return n;
+}
+
+int JackBackend::process_wrap(jack_nframes_t nframes, void *backend) {
+  return static_cast<JackBackend *>(backend)->audioClient->process(nframes);
+}
+
+int JackBackend::bufsize_wrap(jack_nframes_t nframes, void *backend) {
+  return static_cast<JackBackend *>(backend)->audioClient->bufferSizeChanged(nframes);
+}
@@ -0,0 +1,42 @@
+#ifndef JACKBACKEND_H
+#define JACKBACKEND_H
+
+#include "audiobackend.h"
+#include "mixmatrix.h"
+
+#include <jack/jack.h>
+
+#include <array>
+#include <atomic>
+
+class JackBackend : public AudioBackend {
+
+public:
+  JackBackend(const char *clientName="wavPlayer");
+  ~JackBackend();
+
+  bool open(AudioClient *client);
+  void activate();
+  void deactivate();
+
+  unsigned int sampleRate() const;
+  unsigned int bufferSize() const;
+
+  bool addOutput(unsigned int index);
+  float *outputBuffer(unsigned int index, unsigned int nframes);
+
+  bool addMidiInput();
+  unsigned int midiEvents(unsigned int nframes, MidiEvent *events, unsigned int max);
+
+private:
+  jack_client_t *client;
+  AudioClient *audioClient;
+  std::array<jack_port_t *, MixMatrix::maxChannels> outputPorts;
+  std::atomic<jack_port_t *> midiPort;
+  bool active;
+
+  static int process_wrap(jack_nframes_t, void *);
+  static int bufsize_wrap(jack_nframes_t, void *);
+};
+
+#endif
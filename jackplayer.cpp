@@ -1,4 +1,6 @@
 #include "jackplayer.h"
+#include "jackbackend.h"
+#include "rtcheck.h"
 #include "wave.h"
 
 #include <assert.h>
@@ -12,7 +14,16 @@
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
-#include <math>
+#include <cmath>
+#include <string>
+
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 using std::array;
 using std::unique_ptr;
@@ -21,6 +32,8 @@ using std::make_pair;
 using std::cerr;
 using std::endl;
 
+const size_t JackPlayer::defaultMemoryLockBudget;
+
 /* 
  * state: playing or stopped
  *
@@ -31,71 +44,257 @@ using std::endl;
  *
  */
 
-JackPlayer::JackPlayer(QObject *parent) : QObject(parent), curSample(nullptr), resampler(nullptr)
+JackPlayer::JackPlayer(QObject *parent, unsigned int outputs, AudioBackend *b) :
+  QObject(parent), curSample(nullptr), resampler(nullptr), curLocked(0),
+  routing(new MixMatrix(MixMatrix::defaultRouting(2, outputs ? outputs : 2))),
+  backend(b ? b : new JackBackend()),
+  nOutputPorts(0), portsFollowWave(outputs == 0), customRouting(false),
+  loopStart(0), loopEnd(0), loopRegion(0),
+  nextRegion(0), chaining(false),
+  reclaimRunning(true), deferredFrees(0), queueFullEvents(0), voicesStolen(0),
+  lockFailures(0), lockedBytes(0), memoryLockBudget(defaultMemoryLockBudget),
+  haveStreamPending(false), streamFill(0),
+  loadedChannels(0), guiStream(nullptr), guiLoopStart(0), guiLoopEnd(0)
  {
-  client = jack_client_open("wavPlayer", JackNullOption, 0 , 0);
-  if (client == nullptr) {
-    cerr << __func__ << " client failed!" << endl;
-  }
+  sem_init(&reclaimSignal, 0, 0);
+  reclaimThread = std::thread(&JackPlayer::reclaim, this);
 
-  outputPort1 = jack_port_register (client,
-                                    "output1",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsOutput,
-                                    0);
-  outputPort2 = jack_port_register (client,
-                                    "output2",
-                                    JACK_DEFAULT_AUDIO_TYPE,
-                                    JackPortIsOutput,
-                                    0);
-
-  jack_set_process_callback( client, process_wrap, this );
+  if (!backend->open(this)) {
+    cerr << __func__ << " can't open audio backend!" << endl;
+  }
+  bufferSizeChanged(backend->bufferSize());
 
-  samplerate = jack_get_sample_rate(client);
+  samplerate = backend->sampleRate();
 
   state = STOPPED;
 
   startTimer(20);
 
-  jack_activate(client);
-
-  jack_connect(client, "wavPlayer:output1", "system:playback_1");
-  jack_connect(client, "wavPlayer:output2", "system:playback_2");
+  backend->activate();
+  if (!backend->addMidiInput()) {
+    cerr << __func__ << " no MIDI input" << endl;
+  }
 
+  // when following the wave, start with a stereo pair until a wave is loaded
+  registerOutputs(outputs ? outputs : 2);
 }
 
 JackPlayer::~JackPlayer(void) {
-  jack_deactivate(client);
-  jack_client_close(client);
+  backend->deactivate();
   qDebug() << __func__ << "closed client";
+
+  log.flush();
+
+  reclaimRunning = false;
+  sem_post(&reclaimSignal);
+  reclaimThread.join();
+  sem_destroy(&reclaimSignal);
+
+  // the queues don't destroy what is left in them
+  LoadedWave pWave;
+  while (inQueue.pop(pWave) || outQueue.pop(pWave) ) {
+  }
+  unique_ptr<MixMatrix> pMatrix;
+  while (routingIn.pop(pMatrix) || routingOut.pop(pMatrix) ) {
+  }
+  unique_ptr<SliceTable> pSlices;
+  while (slicesIn.pop(pSlices) || slicesOut.pop(pSlices) ) {
+  }
+  unique_ptr<RegionList> pRegions;
+  while (regionsIn.pop(pRegions) || regionsOut.pop(pRegions) ) {
+  }
+  pair<unique_ptr<DiskStream>, Resampler_ptr> pStream;
+  while (streamIn.pop(pStream) || streamOut.pop(pStream) ) {
+  }
 }
 
-int JackPlayer::process_wrap(jack_nframes_t nframes, void *player) {
-  return static_cast<JackPlayer *>(player)->process(nframes);
+/* Reclaim thread: free the waves, resamplers and routing matrices
+ * retired by process(), independent of the Qt event loop. */
+void JackPlayer::reclaim(void) {
+#ifdef SCHED_IDLE
+  sched_param param;
+  param.sched_priority = 0;
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+  while (reclaimRunning) {
+    while (sem_wait(&reclaimSignal) != 0) {
+      // interrupted by a signal, wait again
+    }
+
+    LoadedWave pOut;
+    while (outQueue.pop(pOut) ) {
+      if (pOut.lockedBytes) {
+        munlock(pOut.wave->samples.data(), pOut.lockedBytes);
+        lockedBytes -= pOut.lockedBytes;
+      }
+      pOut.wave.reset();
+      pOut.resampler.reset();
+      pOut.voices.reset();
+      ++deferredFrees;
+    }
+    unique_ptr<MixMatrix> mOut;
+    while (routingOut.pop(mOut) ) {
+      mOut.reset();
+      ++deferredFrees;
+    }
+    unique_ptr<SliceTable> tOut;
+    while (slicesOut.pop(tOut) ) {
+      tOut.reset();
+      ++deferredFrees;
+    }
+    unique_ptr<RegionList> rOut;
+    while (regionsOut.pop(rOut) ) {
+      rOut.reset();
+      ++deferredFrees;
+    }
+    pair<unique_ptr<DiskStream>, Resampler_ptr> sOut;
+    while (streamOut.pop(sOut) ) {
+      // joins the stream's I/O thread
+      sOut.first.reset();
+      sOut.second.reset();
+      ++deferredFrees;
+    }
+  }
 }
 
-int JackPlayer::process(jack_nframes_t nframes) {
+PlayerStats JackPlayer::stats(void) const {
+  PlayerStats s;
+  s.deferredFrees = deferredFrees;
+  s.queueFullEvents = queueFullEvents;
+  s.voicesStolen = voicesStolen;
+  s.lockFailures = lockFailures;
+  s.lockedBytes = lockedBytes;
+  return s;
+}
 
-  // queue new sample if needed
-  pair<unique_ptr<Wave>, SRC_STATE_ptr > newSample;
-  while(inQueue.pop(newSample)) {
-    // if we have a sample, make sure we are able to push it onto the
-    // outQueue so it gets cleaned up in the other thread:
-    if (curSample != nullptr || outQueue.push(make_pair(std::move(curSample), std::move(resampler)) ) ) {
-        curSample = std::move(newSample.first);
-        resampler = std::move(newSample.second);
-        reset();
+/* The backend doesn't run process() while the buffer size changes, so
+ * we can safely grow the scratch buffers here. They are never shrunk, so
+ * switching back to a smaller period doesn't allocate. */
+int JackPlayer::bufferSizeChanged(unsigned int nframes) {
+  const auto size = static_cast<size_t>(nframes) * MixMatrix::maxChannels;
+  if (resampleBuffer.size() < size) {
+    resampleBuffer.resize(size);
+    streamBuffer.resize(size);
+    voiceBuffer.resize(size);
+  }
+  return 0;
+}
+
+int JackPlayer::process(unsigned int nframes) {
+  RT_CHECK_SCOPE;
+
+  // swap in a new routing matrix, but only once the old one can be
+  // handed to the reclaim thread
+  if (routingPending == nullptr) {
+    routingIn.pop(routingPending);
+  }
+  if (routingPending != nullptr) {
+    if (routingOut.push(std::move(routing)) ) {
+      routing = std::move(routingPending);
+      sem_post(&reclaimSignal);
+    } else {
+      ++queueFullEvents;
     }
   }
 
+  // and for new slice tables: take them all, so that we end up with the
+  // newest, and hand the ones they replace to the reclaim thread
+  bool retiredSlices = false;
+  while (slicesPending != nullptr || slicesIn.pop(slicesPending) ) {
+    if (slices != nullptr) {
+      if (!slicesOut.push(std::move(slices)) ) {
+        ++queueFullEvents;
+        break;
+      }
+      retiredSlices = true;
+    }
+    slices = std::move(slicesPending);
+  }
+  if (retiredSlices) {
+    sem_post(&reclaimSignal);
+  }
+
+  // same for a new sample: the current one, if any, has to go to the
+  // reclaim thread. If outQueue is full, keep the new sample pending
+  // and try again next period.
+  while (samplePending.wave != nullptr || inQueue.pop(samplePending) ) {
+    if (curSample != nullptr) {
+      LoadedWave retired = {std::move(curSample), std::move(resampler), std::move(voices),
+                            curLocked};
+      if (!outQueue.push(std::move(retired)) ) {
+        // push() leaves 'retired' alone when the queue is full
+        curSample = std::move(retired.wave);
+        resampler = std::move(retired.resampler);
+        voices = std::move(retired.voices);
+        ++queueFullEvents;
+        break;
+      }
+      sem_post(&reclaimSignal);
+    }
+    curSample = std::move(samplePending.wave);
+    resampler = std::move(samplePending.resampler);
+    voices = std::move(samplePending.voices);
+    curLocked = samplePending.lockedBytes;
+    reset();
+    state = STOPPED;
+    chaining = false;
+  }
+
+  swapStream();
+
+  readLoop();
+
   // read and process incoming events (play/pause/loop/...)
   readCommands();
+  readMidi(nframes);
 
   // write to Jack output buffer
   writeBuffer(nframes);
   return 0;
 }
 
+/* Switch to a new stream (or back to curSample, if the new stream is
+ * null) once the current stream can be handed to the reclaim thread. */
+void JackPlayer::swapStream(void) {
+  if (!haveStreamPending) {
+    haveStreamPending = streamIn.pop(streamPending);
+  }
+  if (!haveStreamPending) {
+    return;
+  }
+  if (curStream != nullptr) {
+    auto retired = make_pair(std::move(curStream), std::move(streamResampler));
+    if (!streamOut.push(std::move(retired)) ) {
+      curStream = std::move(retired.first);
+      streamResampler = std::move(retired.second);
+      ++queueFullEvents;
+      return;
+    }
+    sem_post(&reclaimSignal);
+  }
+  curStream = std::move(streamPending.first);
+  streamResampler = std::move(streamPending.second);
+  haveStreamPending = false;
+  streamFill = 0;
+  reset();
+  state = STOPPED;
+  chaining = false;
+}
+
+inline unsigned int JackPlayer::curChannels(void) const {
+  return curStream ? curStream->channels() : curSample->channels;
+}
+
+/* Length of what we are playing, in samples. */
+inline unsigned long JackPlayer::curLength(void) const {
+  return curStream ? curStream->frames()*curStream->channels() : curSample->samples.size();
+}
+
+inline Resampler *JackPlayer::curResampler(void) const {
+  return curStream ? streamResampler.get() : resampler.get();
+}
+
 void JackPlayer::play(unsigned int start, unsigned int end) {
   qDebug() << __func__;
   sendCommand({Command::Play, start, end});
@@ -103,7 +302,10 @@ void JackPlayer::play(unsigned int start, unsigned int end) {
 
 void JackPlayer::loop(unsigned int start, unsigned int end) {
   qDebug() << __func__;
-  sendCommand({Command::Loop, start, end});
+  if (start || end) {
+    setLoop(start ? start : guiLoopStart, end ? end : guiLoopEnd);
+  }
+  sendCommand(Command::Loop);
 }
 
 void JackPlayer::pause(void) {
@@ -116,31 +318,140 @@ void JackPlayer::stop(void) {
   sendCommand(Command::Stop);
 }
 
-void JackPlayer::setLoopStart(unsigned int start) {
-  if (curSample != nullptr) {
-    loopStart = start*(curSample->channels);
-    qDebug() << __func__ << loopStart;
+void JackPlayer::playRegions(const std::vector<std::pair<unsigned int, unsigned int> > &frames) {
+  qDebug() << __func__ << frames.size();
+  auto list = unique_ptr<RegionList>(new RegionList());
+  for(auto &region : frames) {
+    list->push_back(make_pair(static_cast<unsigned long>(region.first)*loadedChannels,
+                              static_cast<unsigned long>(region.second)*loadedChannels));
+  }
+  if (!regionsIn.push(std::move(list)) ) {
+    ++queueFullEvents;
+    cerr << "Can't write to regionsIn" << endl;
+    return;
   }
+  sendCommand(Command::PlayRegions);
+}
+
+void JackPlayer::trigger(unsigned int start, unsigned int end) {
+  sendCommand({Command::Trigger, start, end});
+}
+
+void JackPlayer::setSlices(const std::vector<std::pair<unsigned int, unsigned int> > &regions,
+                           unsigned char baseNote) {
+  auto table = unique_ptr<SliceTable>(new SliceTable());
+  table->baseNote = baseNote;
+  for(auto &region : regions) {
+    table->regions.push_back(make_pair(static_cast<unsigned long>(region.first)*loadedChannels,
+                                       static_cast<unsigned long>(region.second)*loadedChannels));
+  }
+  // replaces a table that is still waiting for room
+  slicesUnsent = std::move(table);
+  sendSlices();
+}
+
+/* Hand the newest slice table to process(). If slicesIn is full, it
+ * waits in slicesUnsent, and timerEvent() tries again. */
+void JackPlayer::sendSlices(void) {
+  if (slicesUnsent != nullptr && !slicesIn.push(std::move(slicesUnsent)) ) {
+    ++queueFullEvents;
+  }
+}
+
+/* Publish both loop bounds in one atomic store, so that process()
+ * never sees the start of one region with the end of another. */
+void JackPlayer::setLoop(unsigned int start, unsigned int end) {
+  qDebug() << __func__ << start << end;
+  loopRegion.store(static_cast<uint64_t>(start) << 32 | end, std::memory_order_release);
+  const bool startMoved = (start != guiLoopStart);
+  guiLoopStart = start;
+  guiLoopEnd = end;
+  if (guiStream && startMoved) {
+    updateCues();
+  }
+}
+
+void JackPlayer::setLoopStart(unsigned int start) {
+  setLoop(start, guiLoopEnd);
 }
 
 void JackPlayer::setLoopEnd(unsigned int end) {
-  if (curSample != nullptr) {
-    loopEnd = end*(curSample->channels);
-    qDebug() << __func__ << loopEnd;
+  setLoop(guiLoopStart, end);
+}
+
+/* Take the loop region last published by setLoop(), at the start of a
+ * period. A region that is empty once clamped to what we are playing,
+ * e.g. one set for a longer wave, loops everything instead. */
+inline void JackPlayer::readLoop(void) {
+  if (curSample == nullptr && curStream == nullptr) {
+    return;
+  }
+  const auto region = loopRegion.load(std::memory_order_acquire);
+  const auto channels = curChannels();
+  const auto start = std::min((region >> 32) * channels, curLength());
+  const auto end = std::min((region & 0xffffffff) * channels, curLength());
+  if (start < end) {
+    loopStart = start;
+    loopEnd = end;
+  } else {
+    loopStart = 0;
+    loopEnd = curLength();
+  }
+}
+
+void JackPlayer::setCuePoints(const std::vector<unsigned int> &frames) {
+  cuePoints.assign(frames.begin(), frames.end());
+  if (guiStream) {
+    updateCues();
+  }
+}
+
+/* Cache the cue points and the loop start of the stream. */
+void JackPlayer::updateCues(void) {
+  auto cues = cuePoints;
+  cues.push_back(guiLoopStart);
+  guiStream->setCuePoints(std::move(cues));
+}
+
+unsigned int JackPlayer::outputCount(void) const {
+  return nOutputPorts.load(std::memory_order_acquire);
+}
+
+/* Add output ports to the backend until we have n of them. */
+void JackPlayer::registerOutputs(unsigned int n) {
+  n = std::min(n, MixMatrix::maxChannels);
+  for(auto i = nOutputPorts.load(std::memory_order_relaxed); i < n; ++i) {
+    if (!backend->addOutput(i)) {
+      break;
+    }
+    // publish the port to the process thread
+    nOutputPorts.store(i+1, std::memory_order_release);
+  }
+}
+
+void JackPlayer::setRouting(const MixMatrix &m) {
+  customRouting = true;
+  if (!routingIn.push(unique_ptr<MixMatrix>(new MixMatrix(m)) ) ) {
+    ++queueFullEvents;
+    cerr << "Can't write to routingIn" << endl;
   }
 }
 
 void JackPlayer::sendCommand(const Command &e) {
   if (!eventQueue.push(e) ) {
+    ++queueFullEvents;
     cerr << "Can't write to eventQueue" << endl;
   }
 }
 
 /* */
 inline void JackPlayer::reset(void) {
-  assert (curSample != nullptr);
-  playbackIndex = curSample->samples.size();
-  playEnd = curSample->samples.size();
+  if (curSample == nullptr && curStream == nullptr) {
+    state = STOPPED;
+    return;
+  }
+  playbackIndex = curLength();
+  playEnd = curLength();
 }
 
 /* Read all queued events from eventBuffer. */
@@ -148,7 +459,7 @@ void JackPlayer::readCommands(void) {
   Command e;
   while (eventQueue.pop(e) ) {
 
-    if (curSample == nullptr) {
+    if (curSample == nullptr && curStream == nullptr) {
       // If no sample is loaded, we just empty the buffer and ignore the events
       continue;
     }
@@ -156,38 +467,45 @@ void JackPlayer::readCommands(void) {
     // Check that the command we received is valid for the current
     // sample (in principle, we could receive commands for another
     // sample due to synchronization issues)
-    e.start*=curSample->channels;
-    e.end*=curSample->channels;
-    if(e.start > curSample->samples.size() 
-       || e.end > curSample->samples.size()) {
+    const auto channels = curChannels();
+    e.start*=channels;
+    e.end*=channels;
+    if(e.start > curLength()
+       || e.end > curLength()) {
       reset();
       state = STOPPED;
       continue;
     }
     switch(e.type) {
     case Command::Play:
+      chaining = false;
       reset();
       state = PLAYING;
       inputIndex = playbackIndex = e.start;
-      playEnd = e.end ? e.end : curSample->samples.size();
-      src_reset(resampler.get());
-      qDebug() << "Play: " << playbackIndex << playEnd;
+      playEnd = e.end ? e.end : curLength();
+      curResampler()->reset();
+      streamFill = 0;
+      if (curStream) {
+        curStream->seek(e.start/channels);
+      }
+      log.post("Play:", playbackIndex, playEnd);
       break;
     case Command::Loop:
+      chaining = false;
       state = LOOPING;
-      if(e.start) {
-        loopStart = e.start;
-      }
+      // loop() may have published the region after this period started
+      readLoop();
       inputIndex = playbackIndex = loopStart;
-      if (e.end) {
-        loopEnd = e.end;
+      curResampler()->reset();
+      streamFill = 0;
+      if (curStream) {
+        curStream->seek(loopStart/channels);
       }
-      src_reset(resampler.get());
-      qDebug() << "Loop: " << playbackIndex << playEnd;
+      log.post("Loop:", playbackIndex, playEnd);
       break;
     case Command::Pause:
+      log.post("JackPlayer Pause/Unpause");
       switch(state) {
-      qDebug() << "JackPlayer Pause/Unpause";
       case PLAYING:
       case LOOPING:
         state = STOPPED;
@@ -199,56 +517,212 @@ void JackPlayer::readCommands(void) {
       }
       break;
     case Command::Stop:
-      qDebug() << "JackPlayer Stopping";
+      log.post("JackPlayer Stopping");
+      chaining = false;
+      reset();
+      state = STOPPED;
+      if (voices) {
+        voices->release();
+      }
+      break;
+    case Command::PlayRegions:
+      swapRegions();
       reset();
       state = STOPPED;
+      if (curStream || regions == nullptr) {
+        // regions only play from a loaded Wave
+        break;
+      }
+      nextRegion = 0;
+      chaining = true;
+      resampler->reset();
+      streamFill = 0;
+      if (nextQueuedRegion()) {
+        state = PLAYING;
+      } else {
+        chaining = false;
+      }
+      log.post("Play regions:", regions->size());
+      break;
+    case Command::Trigger:
+      // voices only play a loaded Wave
+      if (voices && !curStream
+          && voices->trigger(e.start, e.end ? e.end : curLength()) ) {
+        ++voicesStolen;
+      }
       break;
     }
   }
 }
 
+/* Start the slices of the note-ons in this period on the voices, at
+ * the frames of the events. */
+void JackPlayer::readMidi(unsigned int nframes) {
+  array<MidiEvent, 64> events;
+  const auto n = backend->midiEvents(nframes, events.data(), events.size());
+  if (!n || slices == nullptr || voices == nullptr || curStream) {
+    return;
+  }
+  for(unsigned int i=0; i < n; ++i) {
+    const auto &e = events[i];
+    // note-on on any channel; velocity 0 is a note-off
+    if (e.size < 3 || (e.data[0] & 0xf0) != 0x90 || e.data[2] == 0) {
+      continue;
+    }
+    const unsigned int slice = e.data[1] - slices->baseNote;
+    if (e.data[1] < slices->baseNote || slice >= slices->regions.size()) {
+      continue;
+    }
+    const auto &region = slices->regions[slice];
+    if (region.second > curSample->samples.size() || region.first >= region.second) {
+      continue;
+    }
+    if (voices->trigger(region.first, region.second, e.data[2]/127.f, std::min(e.frame, nframes - 1)) ) {
+      ++voicesStolen;
+    }
+  }
+}
+
 void JackPlayer::timerEvent(QTimerEvent *event __attribute__ ((unused)) ) {
-  pair<unique_ptr<Wave>, SRC_STATE_ptr> pOut;
-  while (outQueue.pop(pOut) ) {
-    // pop outQueue until empty...
-    qDebug() << __func__ << ": erasing sample";
- }
+  log.flush();
+  sendSlices();
+  if (loadedChannels)
+    emit positionChanged(playbackIndex/loadedChannels);
 
-  if (curSample != nullptr)
-    emit positionChanged(playbackIndex/curSample->channels);
+}
 
+std::shared_ptr<const Wave> JackPlayer::loadWave(Wave wave) {
+  return loadWave(std::make_shared<const Wave>(std::move(wave)));
 }
 
-const Wave* JackPlayer::loadWave(Wave wave) {
-  auto pWave = unique_ptr<Wave>(new Wave(std::move(wave)));
-  Wave *result = pWave.get();
+std::shared_ptr<const Wave> JackPlayer::loadWave(std::shared_ptr<const Wave> pWave) {
+  if (pWave->channels > MixMatrix::maxChannels) {
+    throw std::runtime_error("Too many channels: " + std::to_string(pWave->channels));
+  }
+  auto result = pWave;
 
-  int error = 0;
-  auto pSrc = SRC_STATE_ptr(src_new(SRC_SINC_FASTEST, pWave->channels, &error));
-  if (error) {
-    throw std::runtime_error(src_strerror(error) );
+  if (portsFollowWave) {
+    registerOutputs(pWave->channels);
   }
 
-  if (inQueue.push(make_pair(std::move(pWave), std::move(pSrc) ) ) ) {
+  // the voices share the table of the polyphase filter, if there is one
+  auto filter = PolyphaseFilter::create(pWave->samplerate, samplerate, pWave->channels);
+  auto pSrc = Resampler_ptr(new Resampler(pWave->channels, filter));
+  auto pVoices = unique_ptr<VoicePool>(new VoicePool(pWave->channels, filter));
+  const auto locked = lockSamples(*pWave);
+
+  const auto channels = pWave->channels;
+  LoadedWave loaded = {std::move(pWave), std::move(pSrc), std::move(pVoices), locked};
+  if (inQueue.push(std::move(loaded)) ) {
+    loadedChannels = channels;
+    if (guiStream) {
+      // stop streaming, go back to playing the wave
+      guiStream = nullptr;
+      if (!streamIn.push(make_pair(unique_ptr<DiskStream>(), Resampler_ptr())) ) {
+        ++queueFullEvents;
+        cerr << "Can't write to streamIn" << endl;
+      }
+    }
+    if (!customRouting
+        && !routingIn.push(unique_ptr<MixMatrix>(new MixMatrix(MixMatrix::defaultRouting(channels, outputCount())))) ) {
+      ++queueFullEvents;
+      cerr << "Can't write to routingIn" << endl;
+    }
     return result;
   } else {
+    // push() leaves 'loaded' alone when the queue is full
+    if (locked) {
+      munlock(loaded.wave->samples.data(), locked);
+      lockedBytes -= locked;
+    }
+    ++queueFullEvents;
     return nullptr;
   }
 }
 
-void JackPlayer::writeBuffer(jack_nframes_t nframes) {
-  float* outputBuffer1= static_cast<float*>(jack_port_get_buffer(outputPort1, nframes));
-  float* outputBuffer2= static_cast<float*>(jack_port_get_buffer(outputPort2, nframes));
+/* Lock the samples of w in memory, within memoryLockBudget, and touch
+ * every page, so that the process thread doesn't page fault on them.
+ * Returns the number of bytes locked. */
+size_t JackPlayer::lockSamples(const Wave &w) {
+  const auto data = reinterpret_cast<const char *>(w.samples.data());
+  const size_t bytes = w.samples.size() * sizeof(float);
+  size_t locked = 0;
+
+  if (bytes && memoryLockBudget) {
+    if (lockedBytes + bytes > memoryLockBudget) {
+      ++lockFailures;
+      cerr << __func__ << ": " << bytes << " bytes of samples exceed the memory lock budget of "
+           << memoryLockBudget << " bytes" << endl;
+    } else if (mlock(data, bytes) != 0) {
+      ++lockFailures;
+      cerr << __func__ << ": can't lock " << bytes << " bytes of samples: "
+           << strerror(errno) << endl;
+    } else {
+      locked = bytes;
+      lockedBytes += bytes;
+    }
+  }
+
+  // mlock() faults the pages in, but if it failed, at least make them
+  // resident now
+  const auto pageSize = sysconf(_SC_PAGESIZE);
+  volatile char sink = 0;
+  for(size_t i=0; i < bytes; i += pageSize) {
+    sink += data[i];
+  }
+  return locked;
+}
+
+const DiskStream* JackPlayer::loadStream(const std::string &fileName, double bufferSeconds) {
+  auto pStream = unique_ptr<DiskStream>(new DiskStream(fileName, bufferSeconds));
+  DiskStream *result = pStream.get();
+  const auto channels = pStream->channels();
+  if (channels > MixMatrix::maxChannels) {
+    throw std::runtime_error("Too many channels: " + std::to_string(channels));
+  }
+
+  if (portsFollowWave) {
+    registerOutputs(channels);
+  }
+
+  auto pSrc = Resampler_ptr(new Resampler(channels, PolyphaseFilter::create(pStream->samplerate(), samplerate, channels)));
+
+  if (!streamIn.push(make_pair(std::move(pStream), std::move(pSrc) ) ) ) {
+    ++queueFullEvents;
+    return nullptr;
+  }
+  loadedChannels = channels;
+  guiStream = result;
+  updateCues();
+  if (!customRouting
+      && !routingIn.push(unique_ptr<MixMatrix>(new MixMatrix(MixMatrix::defaultRouting(channels, outputCount())))) ) {
+    ++queueFullEvents;
+    cerr << "Can't write to routingIn" << endl;
+  }
+  return result;
+}
+
+void JackPlayer::writeBuffer(unsigned int nframes) {
+  const auto nPorts = nOutputPorts.load(std::memory_order_acquire);
+  array<float *, MixMatrix::maxChannels> outputBuffers;
+  for(unsigned int i=0; i < nPorts; ++i) {
+    outputBuffers[i] = backend->outputBuffer(i, nframes);
+  }
 
   unsigned int frames_gen = 0;
   // in each iteration, we fill the outputBuffers until we have written 'nframes' frames, or until we have reached playEnd/loopEnd
   while (frames_gen < nframes) {
     if (state == STOPPED) { // generate empty frames
-      for(; frames_gen < nframes; ++frames_gen) {
-        outputBuffer2[frames_gen] = outputBuffer1[frames_gen] = 0.;
+      for(unsigned int i=0; i < nPorts; ++i) {
+        std::fill(outputBuffers[i] + frames_gen, outputBuffers[i] + nframes, 0.f);
       }
+      frames_gen = nframes;
+    } else if (curStream) {
+      frames_gen += writeStream(outputBuffers.data(), nPorts, frames_gen, nframes - frames_gen);
+    } else if ((state == LOOPING || chaining) && samplerate != curSample->samplerate) {
+      frames_gen += writeStaged(outputBuffers.data(), nPorts, frames_gen, nframes - frames_gen);
     } else { // state == PLAYING or LOOPING
-      auto end = (state == PLAYING) ? playEnd : loopEnd;
+      auto end = std::min((state == PLAYING) ? playEnd : loopEnd, curSample->samples.size());
       const auto inputLeft = (end > playbackIndex) ? (end - playbackIndex) / curSample->channels : 0;
       const auto src_ratio = static_cast<double>(samplerate)/curSample->samplerate;
       const unsigned long outputLeft = round(inputLeft * src_ratio);
@@ -257,12 +731,18 @@ void JackPlayer::writeBuffer(jack_nframes_t nframes) {
       if ( !inputLeft || !outputLeft ) {
         switch (state) {
         case PLAYING:
-          state = STOPPED;
+          if (!nextQueuedRegion()) {
+            state = STOPPED;
+            chaining = false;
+          }
           break;
         case LOOPING:
-          if(loopStart < curSample->samples.size()) {
+          if (loopStart < loopEnd) {
             inputIndex = playbackIndex = loopStart;
-            src_reset(resampler.get());
+            resampler->reset();
+          } else {
+            // nothing to loop, e.g. an empty wave
+            state = STOPPED;
           }
           break;
         default:
@@ -271,55 +751,240 @@ void JackPlayer::writeBuffer(jack_nframes_t nframes) {
       }
 
       if (samplerate == curSample->samplerate) {
-        // no resampling: directly copy data to outputBuffers
-        auto maxFrames = std::min<unsigned long>(frames_gen + inputLeft, nframes);
-        for(; frames_gen < maxFrames; ++frames_gen) {
-          outputBuffer1[frames_gen] = curSample->samples[playbackIndex];
-          if (curSample->channels >=2) {
-            outputBuffer2[frames_gen] = curSample->samples[++playbackIndex];
-            playbackIndex += (curSample->channels -1);
-          } else {
-            outputBuffer2[frames_gen] = curSample->samples[playbackIndex];
-            ++playbackIndex;
-          }
-        }
+        // no resampling: mix data straight from the sample into the outputBuffers
+        auto n = std::min<unsigned long>(inputLeft, nframes - frames_gen);
+        routing->apply(&curSample->samples[playbackIndex], curSample->channels, n,
+                       outputBuffers.data(), nPorts, frames_gen);
+        playbackIndex += n*curSample->channels;
+        frames_gen += n;
       } else {
         // resampling
         SRC_DATA src_data;
         src_data.data_in = const_cast<float *>(&curSample->samples[inputIndex]);
         src_data.data_out = resampleBuffer.data();
-        src_data.input_frames = (curSample->samples.size()-playbackIndex)/curSample->channels;
+        src_data.input_frames = (curSample->samples.size()-inputIndex)/curSample->channels;
         // number of output frames we can generate before reaching
-        // playEnd/loopEnd, or reaching the end of resampleBuffer
-        src_data.output_frames = std::min<unsigned long>(
-          { outputLeft, nframes - frames_gen,
-              resampleBuffer.size()/curSample->channels } );
+        // playEnd/loopEnd; resampleBuffer holds a full period, so
+        // unless we wrap around a loop this is a single src_process call
+        src_data.output_frames = std::min<unsigned long>(outputLeft, nframes - frames_gen);
         src_data.src_ratio = src_ratio;
         src_data.end_of_input = 0;
 
-        int error = src_process(resampler.get(), &src_data);
+        int error = resampler->process(src_data);
         if (error) {
-          throw std::runtime_error(src_strerror(error) );
+          log.post("src_process:", src_strerror(error));
+          state = STOPPED;
+          continue;
         }
 
         inputIndex += curSample->channels * src_data.input_frames_used;
         playbackIndex += curSample->channels * round(src_data.output_frames_gen / src_ratio);
-
-        for(unsigned int i=0; i < src_data.output_frames_gen*curSample->channels;) {
-          outputBuffer1[frames_gen] = resampleBuffer[i];
-          if (curSample->channels >=2) {
-            outputBuffer2[frames_gen] = resampleBuffer[i+1];
-          } else {
-            outputBuffer2[frames_gen] = resampleBuffer[i];
-          }
-          i += (curSample->channels);
-          ++frames_gen;
+        if (!src_data.output_frames_gen) {
+          // the resampler needs input past the end of the sample to
+          // get to the end of the region: that's all we get
+          playbackIndex = end;
+          continue;
         }
+
+        routing->apply(resampleBuffer.data(), curSample->channels, src_data.output_frames_gen,
+                       outputBuffers.data(), nPorts, frames_gen);
+        frames_gen += src_data.output_frames_gen;
+      }
+    }
+  }
+
+  // the voices play on top of the region
+  if (voices && !curStream && voices->active()) {
+    const auto channels = curSample->channels;
+    std::fill(voiceBuffer.begin(), voiceBuffer.begin() + nframes*channels, 0.f);
+    int error = voices->mix(*curSample, static_cast<double>(samplerate)/curSample->samplerate,
+                            voiceBuffer.data(), resampleBuffer.data(), nframes);
+    if (error) {
+      log.post("src_process:", src_strerror(error));
+    }
+    routing->apply(voiceBuffer.data(), channels, nframes, outputBuffers.data(), nPorts, 0, true);
+  }
+}
+
+/* Generate up to nframes frames of a resampled loop or of queued
+ * regions at offset in the output buffers. Instead of resetting the
+ * resampler at the end of a region, we feed it from streamBuffer, which
+ * we fill with the loop, wrapping from loopEnd to loopStart, or with
+ * one region after the other. The resampler keeps its history across
+ * the joins, so they are as continuous as the rest of the audio. */
+unsigned int JackPlayer::writeStaged(float * const *out, unsigned int nPorts,
+                                     unsigned int offset, unsigned int nframes) {
+  const auto channels = curSample->channels;
+  const auto &samples = curSample->samples;
+  const auto src_ratio = static_cast<double>(samplerate)/curSample->samplerate;
+
+  // top up the resampler input with what this call needs, and a bit
+  // of lookahead for its filter
+  const auto want = std::min<unsigned long>(streamBuffer.size()/channels,
+                                            lround(nframes / src_ratio) + 64);
+  while (streamFill < want) {
+    const auto end = (state == LOOPING) ? loopEnd : playEnd;
+    if (inputIndex >= end) {
+      if (state == LOOPING && loopStart < loopEnd) {
+        inputIndex = loopStart;
+      } else if (state != LOOPING && nextQueuedRegion()) {
+        // continue with the next region
+      } else {
+        break;
+      }
+      continue;
+    }
+    const auto n = std::min<unsigned long>(want - streamFill, (end - inputIndex) / channels);
+    std::copy(samples.begin() + inputIndex, samples.begin() + inputIndex + n*channels,
+              streamBuffer.begin() + streamFill*channels);
+    streamFill += n;
+    inputIndex += n*channels;
+  }
+
+  SRC_DATA src_data;
+  src_data.data_in = streamBuffer.data();
+  src_data.data_out = resampleBuffer.data();
+  src_data.input_frames = streamFill;
+  src_data.output_frames = nframes;
+  src_data.src_ratio = src_ratio;
+  src_data.end_of_input = 0;
+
+  int error = resampler->process(src_data);
+  if (error) {
+    log.post("src_process:", src_strerror(error));
+    state = STOPPED;
+    return 0;
+  }
+
+  std::copy(streamBuffer.begin() + src_data.input_frames_used*channels,
+            streamBuffer.begin() + streamFill*channels, streamBuffer.begin());
+  streamFill -= src_data.input_frames_used;
+
+  const auto n = src_data.output_frames_gen;
+  routing->apply(resampleBuffer.data(), channels, n, out, nPorts, offset);
+
+  playbackIndex += channels * lround(n / src_ratio);
+  if (state == LOOPING && playbackIndex >= loopEnd && loopStart < loopEnd) {
+    playbackIndex = loopStart + (playbackIndex - loopEnd) % (loopEnd - loopStart);
+  }
+
+  if (!n) {
+    if (state == LOOPING) {
+      // empty loop
+      for(unsigned int i=0; i < nPorts; ++i) {
+        std::fill(out[i] + offset, out[i] + offset + nframes, 0.f);
       }
+      return nframes;
     }
+    // all regions went in, what's left is the resampler's delay
+    chaining = false;
+    state = STOPPED;
   }
+  return n;
 }
 
-const Wave& JackPlayer::getCurWave(void) const {
-  return *curSample;
+/* Move on to the next region from playRegions(), if there is one. */
+bool JackPlayer::nextQueuedRegion(void) {
+  while (chaining && nextRegion < regions->size()) {
+    const auto &region = (*regions)[nextRegion++];
+    if (region.first < region.second && region.second <= curSample->samples.size()) {
+      inputIndex = playbackIndex = region.first;
+      playEnd = region.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Take the region list of the latest playRegions(), once the current
+ * one can be handed to the reclaim thread. */
+void JackPlayer::swapRegions(void) {
+  if (regionsPending == nullptr) {
+    regionsIn.pop(regionsPending);
+  }
+  if (regionsPending != nullptr) {
+    if (regions == nullptr) {
+      regions = std::move(regionsPending);
+    } else if (regionsOut.push(std::move(regions)) ) {
+      regions = std::move(regionsPending);
+      sem_post(&reclaimSignal);
+    } else {
+      ++queueFullEvents;
+    }
+  }
+}
+
+/* Generate up to nframes frames from curStream at offset in the output
+ * buffers. Returns 0 if we reached the end of the region, after
+ * updating the state. When the disk can't keep up, the rest of the
+ * period is silent. */
+unsigned int JackPlayer::writeStream(float * const *out, unsigned int nPorts,
+                                     unsigned int offset, unsigned int nframes) {
+  const auto channels = curStream->channels();
+  const auto end = ((state == PLAYING) ? playEnd : loopEnd) / channels;
+  const auto pos = playbackIndex / channels;
+
+  if (pos >= end) {
+    if (state == LOOPING && loopStart < loopEnd) {
+      inputIndex = playbackIndex = loopStart;
+      curStream->seek(loopStart/channels);
+      streamFill = 0;
+      streamResampler->reset();
+    } else {
+      state = STOPPED;
+    }
+    return 0;
+  }
+
+  unsigned long n = 0;
+  if (samplerate == curStream->samplerate()) {
+    n = curStream->read(resampleBuffer.data(), std::min<unsigned long>(end - pos, nframes));
+    routing->apply(resampleBuffer.data(), channels, n, out, nPorts, offset);
+    playbackIndex += n*channels;
+  } else {
+    const auto src_ratio = static_cast<double>(samplerate)/curStream->samplerate();
+    // top up the resampler input, without reading past the end of the region
+    const auto streamPos = curStream->position();
+    const auto inputLeft = end > streamPos ? end - streamPos : 0;
+    const auto want = std::min<unsigned long>(streamBuffer.size()/channels - streamFill, inputLeft);
+    streamFill += curStream->read(&streamBuffer[streamFill*channels], want);
+
+    SRC_DATA src_data;
+    src_data.data_in = streamBuffer.data();
+    src_data.data_out = resampleBuffer.data();
+    src_data.input_frames = streamFill;
+    src_data.output_frames = std::min<unsigned long>(lround((end - pos)*src_ratio), nframes);
+    src_data.src_ratio = src_ratio;
+    src_data.end_of_input = 0;
+
+    int error = streamResampler->process(src_data);
+    if (error) {
+      log.post("src_process:", src_strerror(error));
+      state = STOPPED;
+      return 0;
+    }
+
+    std::copy(streamBuffer.begin() + src_data.input_frames_used*channels,
+              streamBuffer.begin() + streamFill*channels, streamBuffer.begin());
+    streamFill -= src_data.input_frames_used;
+
+    n = src_data.output_frames_gen;
+    routing->apply(resampleBuffer.data(), channels, n, out, nPorts, offset);
+    playbackIndex += channels * lround(n / src_ratio);
+
+    if (!n && !inputLeft) {
+      // everything up to the end went in, what's left is the resampler's delay
+      playbackIndex = end*channels;
+      return 0;
+    }
+  }
+
+  if (!n) {
+    // underrun: the I/O thread hasn't caught up yet
+    for(unsigned int i=0; i < nPorts; ++i) {
+      std::fill(out[i] + offset, out[i] + offset + nframes, 0.f);
+    }
+    return nframes;
+  }
+  return n;
 }
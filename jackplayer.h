@@ -3,6 +3,13 @@
 
 #include <memory>
 #include <array>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include <semaphore.h>
 
 #include <QObject>
 
@@ -10,9 +17,12 @@
 #include "spsc_queue.hpp"
 #endif
 
-#include <jack/jack.h>
-
-#include <samplerate.h>
+#include "audiobackend.h"
+#include "diskstream.h"
+#include "mixmatrix.h"
+#include "resampler.h"
+#include "rtlog.h"
+#include "voicepool.h"
 
 enum PlayState {
   PLAYING,
@@ -22,32 +32,94 @@ enum PlayState {
 
 class Wave;
 
-struct Free_SRC_STATE {
-public:
-  void operator() (SRC_STATE *p) { src_delete(p); }
+struct PlayerStats {
+  unsigned long deferredFrees; // waves and matrices freed by the reclaim thread
+  unsigned long queueFullEvents; // pushes onto a full queue (retried or dropped)
+  unsigned long voicesStolen; // triggers that cut off a playing voice
+  unsigned long lockFailures; // waves whose samples couldn't be locked in memory
+  size_t lockedBytes; // sample memory locked now
+};
+
+// a Wave, with what the process thread needs to play it. The GUI may
+// share the wave; the process thread only ever moves its pointer.
+struct LoadedWave {
+  std::shared_ptr<const Wave> wave;
+  Resampler_ptr resampler;
+  std::unique_ptr<VoicePool> voices;
+  size_t lockedBytes; // of wave->samples, locked with mlock()
+};
+
+// regions that MIDI notes play: note baseNote + i plays regions[i]
+struct SliceTable {
+  unsigned char baseNote;
+  std::vector<std::pair<unsigned long, unsigned long> > regions; // samples
 };
 
-typedef std::unique_ptr<SRC_STATE, Free_SRC_STATE> SRC_STATE_ptr;
-typedef boost::lockfree::spsc_queue<std::pair<std::unique_ptr<Wave>, SRC_STATE_ptr>, boost::lockfree::capacity<10> > spsc_wave_queue;
+typedef boost::lockfree::spsc_queue<LoadedWave, boost::lockfree::capacity<10> > spsc_wave_queue;
+typedef boost::lockfree::spsc_queue<std::unique_ptr<MixMatrix>, boost::lockfree::capacity<10> > spsc_matrix_queue;
+// regions played back to back by playRegions(), in samples
+typedef std::vector<std::pair<unsigned long, unsigned long> > RegionList;
+
+typedef boost::lockfree::spsc_queue<std::unique_ptr<RegionList>, boost::lockfree::capacity<10> > spsc_region_queue;
+typedef boost::lockfree::spsc_queue<std::unique_ptr<SliceTable>, boost::lockfree::capacity<10> > spsc_slice_queue;
+typedef boost::lockfree::spsc_queue<std::pair<std::unique_ptr<DiskStream>, Resampler_ptr>, boost::lockfree::capacity<10> > spsc_stream_queue;
 
 
-class JackPlayer : public QObject {
+/* The playback engine. Audio I/O goes through an AudioBackend: JACK
+ * by default, or e.g. a NullBackend for headless runs. */
+class JackPlayer : public QObject, public AudioClient {
   Q_OBJECT
 
 public:
-  JackPlayer(QObject *parent=0);
+  // outputs: number of output ports to register, or 0 to register
+  // as many ports as the loaded Wave has channels.
+  // backend: takes ownership; a JackBackend is created if null
+  JackPlayer(QObject *parent=0, unsigned int outputs=2, AudioBackend *backend=nullptr);
   ~JackPlayer();
 
-  const Wave* loadWave(Wave w);
+  // play w from the next period on; null if the process thread has not
+  // taken the previous wave yet. The wave stays valid as long as the
+  // pointer returned, whatever the process thread does with it.
+  std::shared_ptr<const Wave> loadWave(Wave w);
+  std::shared_ptr<const Wave> loadWave(std::shared_ptr<const Wave> w);
+  // stream fileName from disk, instead of playing a loaded Wave;
+  // bufferSeconds: how far to read ahead
+  const DiskStream* loadStream(const std::string &fileName, double bufferSeconds=2.);
+  // when streaming, keep the audio after these frames cached, so that
+  // Play and Loop commands starting there don't wait for the disk
+  void setCuePoints(const std::vector<unsigned int> &frames);
+  unsigned int outputCount() const;
+  // route the channels of the loaded Wave through m, instead of the
+  // default MixMatrix::defaultRouting()
+  void setRouting(const MixMatrix &m);
+  // Note-ons on the MIDI input play these regions (in frames) on the
+  // voices, starting at the frame of the event: note baseNote plays
+  // the first region, and so on. The default base note is C1.
+  void setSlices(const std::vector<std::pair<unsigned int, unsigned int> > &regions,
+                 unsigned char baseNote=36);
+  // loop frames [start, end); takes effect at the next period
+  void setLoop(unsigned int start, unsigned int end);
   void setLoopStart(unsigned int start);
   void setLoopEnd(unsigned int end);
-  const Wave& getCurWave() const;
+  // state of the process thread: only meaningful when called from
+  // that thread, e.g. when driving a NullBackend in Manual mode
+  PlayState playState() const { return state; }
+  PlayerStats stats() const;
+  // Loaded samples are locked in memory, so that playing them can't
+  // page fault, as long as the waves in memory fit in this many bytes.
+  // 0 disables locking.
+  void setMemoryLockBudget(size_t bytes) { memoryLockBudget = bytes; }
+  static const size_t defaultMemoryLockBudget = 512ul << 20;
 
 public slots:
   void pause();
   void play(unsigned int start=0, unsigned int end=0);
   void loop(unsigned int start=0, unsigned int end=0);
   void stop();
+  // play these regions (in frames) one after the other, without gaps
+  void playRegions(const std::vector<std::pair<unsigned int, unsigned int> > &regions);
+  // play a region on one of the voices, on top of what is playing
+  void trigger(unsigned int start, unsigned int end=0);
 
 private:
 
@@ -57,7 +129,9 @@ private:
       Play,
       Loop,
       Pause,
-      Stop
+      Stop,
+      Trigger,
+      PlayRegions
     };
     
     unsigned int start;
@@ -71,33 +145,115 @@ private:
 
 
   PlayState state;
-  std::unique_ptr<Wave> curSample;
-  SRC_STATE_ptr resampler;
-  jack_port_t *outputPort1, *outputPort2;
-  jack_client_t *client;
+  std::shared_ptr<const Wave> curSample;
+  Resampler_ptr resampler;
+  std::unique_ptr<VoicePool> voices; // for curSample
+  size_t curLocked; // bytes of curSample locked in memory
+  std::unique_ptr<MixMatrix> routing;
+  std::unique_ptr<MixMatrix> routingPending; // waiting for room in routingOut
+  std::unique_ptr<AudioBackend> backend;
+  std::atomic<unsigned int> nOutputPorts; // ports are only added, never removed
+  const bool portsFollowWave;
+  bool customRouting;
   unsigned int samplerate;
 
   unsigned long playbackIndex; /* 0 to curSample->size() */
   unsigned long inputIndex;
   unsigned long loopStart; /* 0 to curSample->size() */
   unsigned long loopEnd;
+  // loop start and end frame, packed into the high and low 32 bits;
+  // written by setLoop(), read by process() in readLoop()
+  std::atomic<uint64_t> loopRegion;
   unsigned long playEnd;
 
-  boost::lockfree::spsc_queue<Command, boost::lockfree::capacity<10> > eventQueue;
+  // room for bursts of triggers
+  boost::lockfree::spsc_queue<Command, boost::lockfree::capacity<64> > eventQueue;
 
   spsc_wave_queue inQueue; // samples in
   spsc_wave_queue outQueue; // samples out, can be freed
 
-  std::array<float, 2048> resampleBuffer;
+  spsc_matrix_queue routingIn;
+  spsc_matrix_queue routingOut;
+
+  std::unique_ptr<SliceTable> slices;
+  std::unique_ptr<SliceTable> slicesPending; // waiting for room in slicesOut
+  spsc_slice_queue slicesIn;
+  spsc_slice_queue slicesOut;
+  std::unique_ptr<SliceTable> slicesUnsent; // GUI thread: waiting for room in slicesIn
+
+  // regions after the one playing, from playRegions()
+  std::unique_ptr<RegionList> regions;
+  std::unique_ptr<RegionList> regionsPending; // waiting for room in regionsOut
+  spsc_region_queue regionsIn;
+  spsc_region_queue regionsOut;
+  size_t nextRegion;
+  bool chaining; // playing the regions from playRegions()
+  // new sample waiting for room in outQueue
+  LoadedWave samplePending;
+
+  // frees what process() pushes onto outQueue, routingOut, slicesOut,
+  // regionsOut and streamOut, posted by process() after each push
+  std::thread reclaimThread;
+  sem_t reclaimSignal;
+  std::atomic<bool> reclaimRunning;
+  std::atomic<unsigned long> deferredFrees;
+  std::atomic<unsigned long> queueFullEvents;
+  std::atomic<unsigned long> voicesStolen;
+  std::atomic<unsigned long> lockFailures;
+  std::atomic<size_t> lockedBytes; // added by loadWave(), subtracted by reclaim()
+  size_t memoryLockBudget;
+
+  // messages from the process thread, printed by timerEvent()
+  RtLog log;
+
+  // when set, we play curStream instead of curSample
+  std::unique_ptr<DiskStream> curStream;
+  Resampler_ptr streamResampler;
+  spsc_stream_queue streamIn; // a null stream ends streaming
+  spsc_stream_queue streamOut;
+  std::pair<std::unique_ptr<DiskStream>, Resampler_ptr> streamPending;
+  bool haveStreamPending;
+  // stream or loop input waiting to be resampled, and its size in frames
+  std::vector<float> streamBuffer;
+  unsigned long streamFill;
+
+  // GUI thread view of what we loaded
+  unsigned int loadedChannels;
+  DiskStream *guiStream;
+  std::vector<unsigned long> cuePoints;
+  unsigned long guiLoopStart;
+  unsigned long guiLoopEnd;
+
+  // RT scratch space, holds one period of MixMatrix::maxChannels
+  // channels; only (re)allocated in bufferSizeChanged()
+  std::vector<float> resampleBuffer;
+  std::vector<float> voiceBuffer; // the voices, mixed
 
-  static int process_wrap(jack_nframes_t, void *);
-  int process(jack_nframes_t nframes);
+  int process(unsigned int nframes);
+  int bufferSizeChanged(unsigned int nframes);
 
   void timerEvent(QTimerEvent *event);
   class Command;
   void sendCommand(const Command &e);
   void readCommands();
-  void writeBuffer(jack_nframes_t nframes);
+  void readLoop();
+  void readMidi(unsigned int nframes);
+  void writeBuffer(unsigned int nframes);
+  unsigned int writeStream(float * const *out, unsigned int nPorts,
+                           unsigned int offset, unsigned int nframes);
+  unsigned int writeStaged(float * const *out, unsigned int nPorts,
+                           unsigned int offset, unsigned int nframes);
+  bool nextQueuedRegion();
+  void swapRegions();
+  void sendSlices();
+  void swapStream();
+  unsigned int curChannels() const;
+  unsigned long curLength() const;
+  Resampler *curResampler() const;
+  void updateCues();
+  void registerOutputs(unsigned int n);
+  void reclaim();
+  size_t lockSamples(const Wave &w);
   void reset();
 
 signals:
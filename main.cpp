@@ -1,10 +1,50 @@
 #include <QApplication>
+#include <QStringList>
+#include <cstring>
+#include "batchslicer.h"
+#include "bench.h"
 #include "mainwindow.h"
+#include "nullbackend.h"
+#include "rtcheck.h"
 
 int main(int argc, char *argv[])
 {
+    // --batch <dir> ...: slice a directory of files and exit, see
+    // batchSlice(); needs no display
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--batch")) {
+            QCoreApplication a(argc, argv);
+            return batchSlice(a.arguments());
+        }
+#ifdef ENGINE_BENCH
+        // --bench [name]: see bench.h
+        if (!strcmp(argv[i], "--bench")) {
+            return runBench(i + 1 < argc ? argv[i + 1] : "");
+        }
+#endif
+    }
+
     QApplication a(argc, argv);
-    MainWindow w;
+
+#ifdef RT_CHECK
+    // --rt-stress [periods [file]]: run the engine without a GUI and
+    // report what process() shouldn't call
+    auto args = a.arguments();
+    auto iStress = args.indexOf("--rt-stress");
+    if (iStress >= 0) {
+        unsigned long periods = args.size() > iStress+1 ? args[iStress+1].toULong() : 100000;
+        auto file = args.size() > iStress+2 ? args[iStress+2].toLocal8Bit() : QByteArray();
+        return rtStress(periods, file.isEmpty() ? nullptr : file.constData());
+    }
+#endif
+
+    // --null-backend: run without a JACK server, discarding the output
+    AudioBackend *backend = nullptr;
+    if (a.arguments().contains("--null-backend")) {
+        backend = new NullBackend();
+    }
+
+    MainWindow w(0, backend);
     w.show();
     
     return a.exec();
@@ -3,6 +3,8 @@
 
 #include "wave.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 
@@ -15,15 +17,20 @@
 #include <QDesktopWidget>
 #include <QMessageBox>
 #include <QKeyEvent>
+#include <QInputDialog>
+#include <QProgressDialog>
 
 using std::vector;
 using std::cerr;
 using std::endl;
 
-MainWindow::MainWindow(QWidget *parent) :
+MainWindow::MainWindow(QWidget *parent, AudioBackend *backend) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    cutter(this, &player, ui->zoomView)
+    player(0, 2, backend),
+    cutter(this, &player, ui->zoomView),
+    exportProgress(nullptr),
+    detectingBeats(false)
 {
   ui->setupUi(this);
 
@@ -46,7 +53,12 @@ MainWindow::MainWindow(QWidget *parent) :
   connect(shortcutPlay, SIGNAL(activated()), &cutter, SLOT(play()) );
 
   enableExport(false);
+  // needs a loaded wave
+  ui->actionDetect_Onsets->setEnabled(false);
+  ui->actionBeat_Grid->setEnabled(false);
   connect(&cutter, SIGNAL(cutsChanged(bool)), this, SLOT(enableExport(bool)) );
+  connect(&exportTimer, SIGNAL(timeout()), this, SLOT(updateExport()) );
+  connect(&analysisTimer, SIGNAL(timeout()), this, SLOT(updateAnalysis()) );
 }
 
 MainWindow::~MainWindow()
@@ -61,13 +73,26 @@ void MainWindow::on_actionQuit_triggered()
 
 void MainWindow::on_actionOpen_triggered()
 {
+  // exports and detectors read the current wave until they are done
+  if (exporter || cutter.analysing())
+    return;
   auto fileName = QFileDialog::getOpenFileName();
   if (!fileName.isEmpty()) {
     try {
-      auto pWave = player.loadWave(soundFileHandler.read(fileName));
-      ui->waveOverview->drawWave(pWave);
-      ui->zoomView->drawWave(pWave);
-      cutter.clear();
+      vector<unsigned int> cuts;
+      auto pWave = player.loadWave(soundFileHandler.read(fileName, &cuts));
+      if (!pWave)
+        throw std::runtime_error("The player is busy");
+      wave = pWave;
+      ui->waveOverview->drawWave(pWave.get());
+      ui->zoomView->drawWave(pWave.get());
+      cutter.clear(pWave);
+      if (!cuts.empty()) {
+        cutter.importCuts(cuts);
+        ui->statusBar->showMessage(tr("Imported %1 cuts").arg(cuts.size()));
+      }
+      ui->actionDetect_Onsets->setEnabled(true);
+      ui->actionBeat_Grid->setEnabled(true);
     } catch (std::runtime_error& e) {
       QMessageBox msgBox;
       msgBox.setText("Error opening file.");
@@ -77,11 +102,32 @@ void MainWindow::on_actionOpen_triggered()
   }
 }
 
+/* Play a file straight from disk, without loading it */
+void MainWindow::on_actionStream_triggered()
+{
+  auto fileName = QFileDialog::getOpenFileName(this, tr("Stream"));
+  if (!fileName.isEmpty()) {
+    try {
+      player.loadStream(fileName.toStdString());
+      player.play();
+    } catch (std::runtime_error& e) {
+      QMessageBox msgBox;
+      msgBox.setText("Error opening file.");
+      msgBox.exec();
+    }
+  }
+}
+
 void MainWindow::on_actionStop_triggered()
 {
   player.stop();
 }
 
+void MainWindow::on_actionPlay_All_Slices_triggered()
+{
+  cutter.playAllSlices();
+}
+
 void MainWindow::on_actionLoop_triggered()
 {
   cutter.loop();
@@ -100,12 +146,224 @@ void MainWindow::on_actionPause_triggered()
 void MainWindow::on_actionExport_triggered()
 {
   auto path = QFileDialog::getSaveFileName(this, tr("Export Directory"));
-  if (!path.isEmpty())
-    cutter.exportSamples(path);
+  ExportFormat format;
+  if (path.isEmpty() || exporter || !askExportFormat(format, tr("Normalize each slice")))
+    return;
+  try {
+    exporter = cutter.exportSamples(path, format);
+  } catch (std::runtime_error& e) {
+    QMessageBox::warning(this, tr("Export"), e.what());
+  }
+  showExportProgress(tr("Exporting slices..."));
+}
+
+void MainWindow::on_actionExport_Sample_Map_triggered()
+{
+  auto fileName = QFileDialog::getSaveFileName(this, tr("Export Sample Map"), QString(),
+                                               tr("WAV files (*.wav)"));
+  ExportFormat format;
+  if (fileName.isEmpty() || exporter || !askExportFormat(format, tr("Normalize")))
+    return;
+  try {
+    exporter = cutter.exportSampleMap(fileName, format);
+  } catch (std::runtime_error& e) {
+    QMessageBox::warning(this, tr("Export"), e.what());
+  }
+  showExportProgress(tr("Exporting sample map..."));
+}
+
+/* Ask for the rate, format and level of an export; false if the user
+ * cancelled. */
+bool MainWindow::askExportFormat(ExportFormat &format, const QString &normalize)
+{
+  QStringList rates;
+  rates << tr("%1 Hz (source)").arg(wave->samplerate)
+        << "44100 Hz" << "48000 Hz" << "88200 Hz" << "96000 Hz";
+  bool ok = false;
+  auto rate = QInputDialog::getItem(this, tr("Export"), tr("Sample rate:"), rates, 0, false, &ok);
+  if (!ok)
+    return false;
+  QStringList formats;
+  formats << tr("16 bit, dithered") << tr("16 bit, noise shaped") << tr("24 bit, dithered")
+          << tr("32 bit float");
+  auto formatName = QInputDialog::getItem(this, tr("Export"), tr("Format:"), formats, 0, false, &ok);
+  if (!ok)
+    return false;
+  QStringList levels;
+  levels << tr("As is") << normalize;
+  auto level = QInputDialog::getItem(this, tr("Export"), tr("Level:"), levels, 0, false, &ok);
+  if (!ok)
+    return false;
+  double gainDb = 0.;
+  if (level == levels[0]) {
+    gainDb = QInputDialog::getDouble(this, tr("Export"), tr("Gain (dB):"), 0., -60., 24., 1, &ok);
+    if (!ok)
+      return false;
+  }
+
+  const auto formatIndex = formats.indexOf(formatName);
+  format.sampleRate = (rate == rates[0]) ? 0 : rate.split(' ')[0].toUInt();
+  format.bits = formatIndex < 2 ? 16 : formatIndex == 2 ? 24 : 32;
+  format.gain = pow(10., gainDb/20.);
+  format.normalize = (level == levels[1]);
+  format.dither = true;
+  format.noiseShaping = (formatIndex == 1);
+  return true;
+}
+
+void MainWindow::showExportProgress(const QString &label)
+{
+  if (!exporter)
+    return;
+  // the files are written in the background, from the current wave
+  ui->actionOpen->setEnabled(false);
+  exportClock.start();
+  exportProgress = new QProgressDialog(label, tr("Cancel"), 0, 1000, this);
+  exportProgress->setWindowModality(Qt::WindowModal);
+  exportProgress->setMinimumDuration(500);
+  connect(exportProgress, SIGNAL(canceled()), this, SLOT(cancelExport()) );
+  exportTimer.start(100);
+}
+
+void MainWindow::updateExport()
+{
+  if (!exporter)
+    return;
+  const auto total = std::max(1ul, exporter->total());
+  if (!exporter->finished()) {
+    exportProgress->setValue(1000 * exporter->progress() / total);
+    return;
+  }
+  exportTimer.stop();
+  exportProgress->setValue(1000);
+  exportProgress->deleteLater();
+  exportProgress = nullptr;
+  try {
+    exporter->wait();
+    // samples of the wave through the output stage, all channels
+    const double seconds = std::max(exportClock.elapsed(), qint64(1))/1000.;
+    const double samples = exporter->total()*wave->channels;
+    ui->statusBar->showMessage(exporter->wasCancelled()
+                               ? tr("Export cancelled")
+                               : tr("Exported %1 frames at %2 Hz in %3 s (%4 Msamples/s)")
+                               .arg(exporter->total()).arg(exporter->sampleRate())
+                               .arg(seconds, 0, 'f', 2).arg(samples/seconds/1e6, 0, 'f', 1));
+  } catch (std::runtime_error& e) {
+    QMessageBox::warning(this, tr("Export"), e.what());
+  }
+  exporter.reset();
+  enableOpen();
+}
+
+void MainWindow::cancelExport()
+{
+  if (exporter)
+    exporter->cancel();
+}
+
+void MainWindow::on_actionRender_Loop_triggered()
+{
+  auto fileName = QFileDialog::getSaveFileName(this, tr("Render Loop"));
+  if (!fileName.isEmpty()) {
+    try {
+      showRenderResult(cutter.renderLoop(fileName, 1));
+    } catch (std::runtime_error& e) {
+      QMessageBox::warning(this, tr("Render Loop"), e.what());
+    }
+  }
+}
+
+void MainWindow::on_actionRender_Slices_triggered()
+{
+  auto fileName = QFileDialog::getSaveFileName(this, tr("Render Slices"));
+  if (!fileName.isEmpty()) {
+    try {
+      showRenderResult(cutter.renderSlices(fileName));
+    } catch (std::runtime_error& e) {
+      QMessageBox::warning(this, tr("Render Slices"), e.what());
+    }
+  }
+}
+
+void MainWindow::on_actionDetect_Onsets_triggered()
+{
+  bool ok = false;
+  auto sensitivity = QInputDialog::getInt(this, tr("Detect Onsets"),
+                                          tr("Sensitivity (%), replaces the cuts:"),
+                                          50, 0, 100, 5, &ok);
+  if (ok) {
+    cutter.detectOnsets(sensitivity / 100.);
+    detectingBeats = false;
+    startAnalysis(tr("Detecting onsets..."));
+  }
+}
+
+void MainWindow::on_actionBeat_Grid_triggered()
+{
+  QStringList steps;
+  steps << tr("Bar") << tr("Beat") << tr("Eighth") << tr("Sixteenth");
+  bool ok = false;
+  auto step = QInputDialog::getItem(this, tr("Beat Grid"), tr("Cut on every:"),
+                                    steps, 1, false, &ok);
+  if (ok) {
+    cutter.detectBeats(static_cast<Cutter::GridStep>(steps.indexOf(step)));
+    detectingBeats = true;
+    startAnalysis(tr("Detecting beats..."));
+  }
+}
+
+/* The cutter detects in the background; until it is done, the wave
+ * stays loaded and no other detection starts. */
+void MainWindow::startAnalysis(const QString &message)
+{
+  ui->actionOpen->setEnabled(false);
+  ui->actionDetect_Onsets->setEnabled(false);
+  ui->actionBeat_Grid->setEnabled(false);
+  ui->statusBar->showMessage(message);
+  analysisTimer.start(100);
+}
+
+void MainWindow::updateAnalysis()
+{
+  try {
+    if (!cutter.finishAnalysis())
+      return;
+    if (detectingBeats) {
+      const auto &grid = cutter.beatGrid();
+      ui->statusBar->showMessage(tr("%1 BPM, confidence %2%3")
+                                 .arg(grid.bpm, 0, 'f', 2)
+                                 .arg(grid.confidence, 0, 'f', 2)
+                                 .arg(grid.confident() ? tr(", loops snap to bars") : QString()));
+    } else {
+      ui->statusBar->clearMessage();
+    }
+  } catch (std::exception& e) {
+    QMessageBox::warning(this, detectingBeats ? tr("Beat Grid") : tr("Detect Onsets"), e.what());
+  }
+  analysisTimer.stop();
+  enableOpen();
+  ui->actionDetect_Onsets->setEnabled(true);
+  ui->actionBeat_Grid->setEnabled(true);
+}
+
+/* Another wave may be opened once nothing reads the current one */
+void MainWindow::enableOpen()
+{
+  ui->actionOpen->setEnabled(!exporter && !cutter.analysing());
+}
+
+void MainWindow::showRenderResult(const RenderResult &result) {
+  ui->statusBar->showMessage(tr("Rendered %1 frames in %2 s (%3x realtime)")
+                             .arg(result.frames)
+                             .arg(result.seconds, 0, 'f', 2)
+                             .arg(result.realtimeFactor, 0, 'f', 1));
 }
 
 void MainWindow::enableExport(bool enabled) {
+  ui->actionPlay_All_Slices->setEnabled(enabled);
   ui->actionExport->setEnabled(enabled);
+  ui->actionExport_Sample_Map->setEnabled(enabled);
+  ui->actionRender_Slices->setEnabled(enabled);
 }
 
 void MainWindow::keyPressEvent(QKeyEvent *event) {
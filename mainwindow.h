@@ -1,12 +1,19 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <QElapsedTimer>
 #include <QMainWindow>
+#include <QTimer>
+
+#include <memory>
 
 #include "jackplayer.h"
 #include "cutter.h"
+#include "sliceexporter.h"
 #include "soundfilehandler.h"
 
+class QProgressDialog;
+
 namespace Ui {
 class MainWindow;
 }
@@ -16,7 +23,8 @@ class MainWindow : public QMainWindow
   Q_OBJECT
   
 public:
-  explicit MainWindow(QWidget *parent = 0);
+  // backend: audio backend for the player, JACK if null
+  explicit MainWindow(QWidget *parent = 0, AudioBackend *backend = nullptr);
   ~MainWindow();
 
 protected:
@@ -28,15 +36,39 @@ private:
   JackPlayer player;
   Cutter cutter;
   SoundFileHandler soundFileHandler;               
+  std::shared_ptr<const Wave> wave; // the one loaded last
+  // the export running in the background, if any
+  std::unique_ptr<SliceExporter> exporter;
+  QProgressDialog *exportProgress;
+  QTimer exportTimer; // polls the exporter
+  QElapsedTimer exportClock;
+  QTimer analysisTimer; // polls the onset or beat detection of the cutter
+  bool detectingBeats;
+
+  void showRenderResult(const RenderResult &result);
+  bool askExportFormat(ExportFormat &format, const QString &normalize);
+  void showExportProgress(const QString &label);
+  void startAnalysis(const QString &message);
+  void enableOpen();
 
 private slots:
   void on_actionQuit_triggered();
   void on_actionOpen_triggered();
+  void on_actionStream_triggered();
   void on_actionPlay_triggered();
   void on_actionLoop_triggered();
   void on_actionPause_triggered();
   void on_actionStop_triggered();
+  void on_actionPlay_All_Slices_triggered();
   void on_actionExport_triggered();
+  void on_actionExport_Sample_Map_triggered();
+  void updateExport();
+  void cancelExport();
+  void on_actionRender_Loop_triggered();
+  void on_actionRender_Slices_triggered();
+  void on_actionDetect_Onsets_triggered();
+  void on_actionBeat_Grid_triggered();
+  void updateAnalysis();
   void enableExport(bool enabled);
   void on_actionZoom_Selection_triggered();
   void on_actionZoom_In_triggered();
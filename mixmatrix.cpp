@@ -0,0 +1,85 @@
+#include "mixmatrix.h"
+
+#include <algorithm>
+#include <cassert>
+
+// frames per block in apply(): the deinterleaved block of all input
+// channels stays in L1 while it is mixed into each output
+static const unsigned int blockSize = 64;
+
+const unsigned int MixMatrix::maxChannels;
+
+MixMatrix::MixMatrix(unsigned int inputs, unsigned int outputs) :
+  nInputs(std::min(inputs, maxChannels)),
+  nOutputs(std::min(outputs, maxChannels)),
+  gains(nInputs*nOutputs, 0.f) {
+}
+
+MixMatrix MixMatrix::defaultRouting(unsigned int inputs, unsigned int outputs) {
+  MixMatrix m(inputs, outputs);
+  for(unsigned int out=0; out < m.nOutputs; ++out) {
+    for(unsigned int in=0; in < m.nInputs; ++in) {
+      if (m.nInputs == 1 || in % m.nOutputs == out) {
+        m.setGain(in, out, 1.f);
+      }
+    }
+  }
+  return m;
+}
+
+void MixMatrix::setGain(unsigned int in, unsigned int out, float gain) {
+  assert(in < nInputs && out < nOutputs);
+  gains[out*nInputs + in] = gain;
+}
+
+void MixMatrix::apply(const float *in, unsigned int inChannels, unsigned int nframes,
+                      float * const *out, unsigned int nOut, unsigned int offset,
+                      bool accumulate) const {
+  const unsigned int nIn = std::min(nInputs, inChannels);
+  const unsigned int nMixed = std::min(nOutputs, nOut);
+
+  float planar[maxChannels][blockSize] __attribute__ ((aligned (32)));
+
+  for(unsigned int done = 0; done < nframes; done += blockSize) {
+    const unsigned int n = std::min(blockSize, nframes - done);
+    const float *src = in + done*inChannels;
+
+    // deinterleave: one strided pass per input channel, so that the
+    // mixing loops below only touch contiguous memory
+    for(unsigned int c=0; c < nIn; ++c) {
+      float * __restrict__ dst = planar[c];
+      for(unsigned int f=0; f < n; ++f) {
+        dst[f] = src[f*inChannels + c];
+      }
+    }
+
+    for(unsigned int o=0; o < nMixed; ++o) {
+      float * __restrict__ dst = out[o] + offset + done;
+      const float *row = &gains[o*nInputs];
+      bool written = accumulate;
+      for(unsigned int c=0; c < nIn; ++c) {
+        const float g = row[c];
+        if (g == 0.f) {
+          continue;
+        }
+        const float * __restrict__ p = planar[c];
+        if (written) {
+          for(unsigned int f=0; f < n; ++f) {
+            dst[f] += g*p[f];
+          }
+        } else {
+          for(unsigned int f=0; f < n; ++f) {
+            dst[f] = g*p[f];
+          }
+          written = true;
+        }
+      }
+      if (!written) {
+        std::fill(dst, dst+n, 0.f);
+      }
+    }
+    for(unsigned int o=nMixed; o < nOut && !accumulate; ++o) {
+      std::fill(out[o] + offset + done, out[o] + offset + done + n, 0.f);
+    }
+  }
+}
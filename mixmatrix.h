@@ -0,0 +1,42 @@
+#ifndef MIXMATRIX_H
+#define MIXMATRIX_H
+
+#include <vector>
+
+/* Routing matrix from the channels of a Wave to the output ports of
+ * the player: gain(in, out) is the gain with which input channel 'in'
+ * is mixed into output port 'out'.
+ */
+class MixMatrix {
+
+public:
+  // maximum number of input channels and output ports
+  static const unsigned int maxChannels = 32;
+
+  MixMatrix(unsigned int inputs=0, unsigned int outputs=0);
+
+  // mono is sent to every output, other channels go to output (channel % outputs)
+  static MixMatrix defaultRouting(unsigned int inputs, unsigned int outputs);
+
+  unsigned int inputs() const { return nInputs; }
+  unsigned int outputs() const { return nOutputs; }
+  float gain(unsigned int in, unsigned int out) const { return gains[out*nInputs + in]; }
+  void setGain(unsigned int in, unsigned int out, float gain);
+
+  // Mix 'nframes' interleaved frames of 'inChannels' channels from
+  // 'in' into out[0..nOut-1], starting at out[i][offset]. Output
+  // ports without a matrix row are filled with silence. With
+  // accumulate, the mix is added to what is in out, and ports without a
+  // row are left alone. Must not allocate: called from the JACK process
+  // thread.
+  void apply(const float *in, unsigned int inChannels, unsigned int nframes,
+             float * const *out, unsigned int nOut, unsigned int offset,
+             bool accumulate=false) const;
+
+private:
+  unsigned int nInputs;
+  unsigned int nOutputs;
+  std::vector<float> gains; // nOutputs rows of nInputs gains
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "nullbackend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+typedef std::chrono::steady_clock Clock;
+
+NullBackend::NullBackend(unsigned int sampleRate, unsigned int bufferSize, Mode mode) :
+  rate(sampleRate), periodSize(bufferSize), mode(mode), client(nullptr),
+  nOutputs(0), running(false), captureChannels(0), fileChannels(0),
+  frames(0), processSeconds(0.) {
+  for(auto &buffer : buffers) {
+    buffer.resize(periodSize, 0.f);
+  }
+}
+
+NullBackend::~NullBackend(void) {
+  deactivate();
+}
+
+bool NullBackend::open(AudioClient *c) {
+  client = c;
+  return true;
+}
+
+void NullBackend::activate(void) {
+  if (running || !client || mode == Manual) {
+    return;
+  }
+  client->bufferSizeChanged(periodSize);
+  running = true;
+  thread = std::thread([this] () {
+      auto deadline = Clock::now();
+      const auto periodLength = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(periodSize)/rate));
+      while (running) {
+        period();
+        if (mode == Realtime) {
+          deadline += periodLength;
+          std::this_thread::sleep_until(deadline);
+        }
+      }
+    });
+}
+
+void NullBackend::deactivate(void) {
+  if (running) {
+    running = false;
+    thread.join();
+  }
+}
+
+unsigned int NullBackend::sampleRate(void) const {
+  return rate;
+}
+
+unsigned int NullBackend::bufferSize(void) const {
+  return periodSize;
+}
+
+bool NullBackend::addOutput(unsigned int index) {
+  if (index >= buffers.size()) {
+    return false;
+  }
+  if (index >= nOutputs) {
+    nOutputs = index+1;
+  }
+  return true;
+}
+
+float *NullBackend::outputBuffer(unsigned int index, unsigned int nframes __attribute__ ((unused)) ) {
+  return buffers[index].data();
+}
+
+void NullBackend::run(unsigned long nframes) {
+  if (mode != Manual || !client) {
+    return;
+  }
+  if (!frames) {
+    client->bufferSizeChanged(periodSize);
+  }
+  for(unsigned long done = 0; done < nframes; done += periodSize) {
+    period();
+  }
+}
+
+void NullBackend::capture(unsigned int channels) {
+  captureChannels = std::min<unsigned int>(channels, buffers.size());
+  captured.clear();
+}
+
+bool NullBackend::writeTo(const std::string &fileName, unsigned int channels) {
+  fileChannels = std::min<unsigned int>(channels, buffers.size());
+  outFile = SndfileHandle(fileName.c_str(), SFM_WRITE,
+                          SF_FORMAT_WAV | SF_FORMAT_FLOAT, fileChannels, rate);
+  if (!outFile) {
+    cerr << __func__ << ": can't open " << fileName << endl;
+    fileChannels = 0;
+    return false;
+  }
+  interleaved.resize(periodSize*fileChannels);
+  return true;
+}
+
+void NullBackend::closeFile(void) {
+  // SndfileHandle closes the file when the last reference goes away
+  outFile = SndfileHandle();
+  fileChannels = 0;
+}
+
+double NullBackend::realtimeFactor(void) const {
+  return processSeconds > 0. ? (static_cast<double>(frames)/rate) / processSeconds : 0.;
+}
+
+bool NullBackend::addMidiInput(void) {
+  return true;
+}
+
+unsigned int NullBackend::midiEvents(unsigned int nframes __attribute__ ((unused)),
+                                     MidiEvent *events, unsigned int max) {
+  const auto n = std::min<size_t>(max, midiPeriod.size());
+  std::copy(midiPeriod.begin(), midiPeriod.begin() + n, events);
+  return n;
+}
+
+void NullBackend::sendMidi(const MidiEvent &e) {
+  std::lock_guard<std::mutex> lock(midiMutex);
+  midiQueue.push_back(e);
+}
+
+void NullBackend::period(void) {
+  {
+    std::lock_guard<std::mutex> lock(midiMutex);
+    midiPeriod.swap(midiQueue);
+    midiQueue.clear();
+  }
+  for(auto &e : midiPeriod) {
+    e.frame = std::min(e.frame, periodSize - 1);
+  }
+  std::stable_sort(midiPeriod.begin(), midiPeriod.end(),
+                   [] (const MidiEvent &a, const MidiEvent &b) { return a.frame < b.frame; });
+
+  auto start = Clock::now();
+  client->process(periodSize);
+  processSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+  frames += periodSize;
+
+  if (captureChannels) {
+    auto offset = captured.size();
+    captured.resize(offset + periodSize*captureChannels);
+    interleave(&captured[offset], captureChannels);
+  }
+  if (fileChannels) {
+    interleave(interleaved.data(), fileChannels);
+    outFile.writef(interleaved.data(), periodSize);
+  }
+}
+
+/* Interleave the first 'channels' output buffers into 'out'; outputs
+ * that were never added are written as silence. */
+void NullBackend::interleave(float *out, unsigned int channels) const {
+  const unsigned int n = std::min<unsigned int>(channels, nOutputs);
+  for(unsigned int f=0; f < periodSize; ++f) {
+    for(unsigned int c=0; c < channels; ++c) {
+      out[f*channels + c] = c < n ? buffers[c][f] : 0.f;
+    }
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef NULLBACKEND_H
+#define NULLBACKEND_H
+
+#include "audiobackend.h"
+#include "mixmatrix.h"
+
+#include <sndfile.hh>
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Backend without an audio device. The output can be kept in memory
+ * or written to a WAV file, which makes runs deterministic and lets us
+ * measure the throughput of the engine. */
+class NullBackend : public AudioBackend {
+
+public:
+  enum Mode {
+    Realtime, // process() from a thread, paced at the sample rate
+    Freewheel, // process() from a thread, as fast as possible
+    Manual // process() only from run(), in the calling thread
+  };
+
+  NullBackend(unsigned int sampleRate=48000, unsigned int bufferSize=256, Mode mode=Realtime);
+  ~NullBackend();
+
+  bool open(AudioClient *client);
+  void activate();
+  void deactivate();
+
+  unsigned int sampleRate() const;
+  unsigned int bufferSize() const;
+
+  bool addOutput(unsigned int index);
+  float *outputBuffer(unsigned int index, unsigned int nframes);
+
+  bool addMidiInput();
+  unsigned int midiEvents(unsigned int nframes, MidiEvent *events, unsigned int max);
+  // deliver e in the next period, at frame e.frame of that period
+  void sendMidi(const MidiEvent &e);
+
+  // Manual mode: process whole periods until at least nframes frames
+  // have been generated
+  void run(unsigned long nframes);
+
+  // keep the first 'channels' outputs of every period in memory,
+  // interleaved; see output()
+  void capture(unsigned int channels);
+  // write the first 'channels' outputs of every period to a float WAV
+  bool writeTo(const std::string &fileName, unsigned int channels);
+  void closeFile();
+
+  const std::vector<float>& output() const { return captured; }
+  unsigned long framesProcessed() const { return frames; }
+  // seconds of audio generated per second spent in process()
+  double realtimeFactor() const;
+
+private:
+  const unsigned int rate;
+  const unsigned int periodSize;
+  const Mode mode;
+  AudioClient *client;
+  std::array<std::vector<float>, MixMatrix::maxChannels> buffers;
+  std::atomic<unsigned int> nOutputs;
+
+  std::thread thread;
+  std::atomic<bool> running;
+
+  unsigned int captureChannels;
+  std::vector<float> captured;
+  SndfileHandle outFile;
+  unsigned int fileChannels;
+  std::vector<float> interleaved;
+
+  unsigned long frames;
+  double processSeconds;
+
+  std::mutex midiMutex;
+  std::vector<MidiEvent> midiQueue; // for the next period
+  std::vector<MidiEvent> midiPeriod; // of the current period
+
+  void period();
+  void interleave(float *out, unsigned int channels) const;
+};
+
+#endif
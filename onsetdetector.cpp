@@ -0,0 +1,255 @@
+#include "onsetdetector.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <thread>
+
+using std::vector;
+
+const unsigned int OnsetDetector::fftSize;
+const unsigned int OnsetDetector::hopSize;
+
+// compression of the magnitudes before differencing: log(1 + compression |X|)
+static const float compression = 100.f;
+// shortest gap between two onsets, and the span of the local mean
+// before and after a peak, in seconds
+static const double minGap = 0.03;
+static const double meanBefore = 0.1;
+static const double meanAfter = 0.03;
+
+namespace {
+
+/* log(1 + x) for x >= 0, to within 1e-6: the exponent of 1 + x, plus
+ * the log of the mantissa m from the series of 2 atanh((m-1)/(m+1)).
+ * Unlike log1pf(), gcc can vectorize a loop over it. */
+inline float fastLog1p(float x) {
+  union { float f; int32_t i; } v = {1.f + x};
+  float e = static_cast<float>(((v.i >> 23) & 0xff) - 127);
+  v.i = (v.i & 0x7fffff) | 0x3f800000;
+  float m = v.f;
+  // m in [sqrt(1/2), sqrt(2)), where the series converges fast
+  const bool high = m > 1.41421356f;
+  m = high ? 0.5f*m : m;
+  e = high ? e + 1.f : e;
+  const float t = (m - 1.f)/(m + 1.f);
+  const float t2 = t*t;
+  return e*0.69314718f + 2.f*t*(1.f + t2*(1.f/3 + t2*(1.f/5 + t2*(1.f/7))));
+}
+
+/* FFT of n real samples, as a complex radix-2 FFT of n/2 points whose
+ * output is untangled into the spectrum of the real input. Real and
+ * imaginary parts are kept apart, and the twiddles of each pass are
+ * stored contiguously, so that gcc vectorizes the butterflies. */
+class RealFft {
+
+public:
+  RealFft(unsigned int n) : half(n/2), reversed(half), twiddleRe(half), twiddleIm(half),
+                            untangleRe(half), untangleIm(half), re(half), im(half) {
+    unsigned int bits = 0;
+    while ((1u << bits) < half) {
+      ++bits;
+    }
+    for(unsigned int i=0; i < half; ++i) {
+      unsigned int r = 0;
+      for(unsigned int b=0; b < bits; ++b) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      reversed[i] = r;
+    }
+    // the pass with butterflies of size len uses len/2 twiddles,
+    // starting at len/2
+    for(unsigned int len=2; len <= half; len <<= 1) {
+      for(unsigned int j=0; j < len/2; ++j) {
+        twiddleRe[len/2 + j] = cos(2*M_PI*j/len);
+        twiddleIm[len/2 + j] = -sin(2*M_PI*j/len);
+      }
+    }
+    for(unsigned int k=0; k < half; ++k) {
+      untangleRe[k] = cos(2*M_PI*k/n);
+      untangleIm[k] = -sin(2*M_PI*k/n);
+    }
+  }
+
+  // magnitudes of bins 0 to n/2 of the n samples at in
+  void magnitudes(const float *in, float *out) {
+    for(unsigned int i=0; i < half; ++i) {
+      re[reversed[i]] = in[2*i];
+      im[reversed[i]] = in[2*i + 1];
+    }
+    for(unsigned int len=2; len <= half; len <<= 1) {
+      const float * __restrict__ wRe = &twiddleRe[len/2];
+      const float * __restrict__ wIm = &twiddleIm[len/2];
+      for(unsigned int i=0; i < half; i += len) {
+        float * __restrict__ uRe = &re[i];
+        float * __restrict__ uIm = &im[i];
+        float * __restrict__ vRe = &re[i + len/2];
+        float * __restrict__ vIm = &im[i + len/2];
+        for(unsigned int j=0; j < len/2; ++j) {
+          const float tRe = vRe[j]*wRe[j] - vIm[j]*wIm[j];
+          const float tIm = vRe[j]*wIm[j] + vIm[j]*wRe[j];
+          vRe[j] = uRe[j] - tRe;
+          vIm[j] = uIm[j] - tIm;
+          uRe[j] += tRe;
+          uIm[j] += tIm;
+        }
+      }
+    }
+    // even samples went into the real parts, odd ones into the
+    // imaginary parts: separate their spectra, and combine them
+    out[0] = std::fabs(re[0] + im[0]);
+    out[half] = std::fabs(re[0] - im[0]);
+    for(unsigned int k=1; k < half; ++k) {
+      const float evenRe = 0.5f*(re[k] + re[half - k]);
+      const float evenIm = 0.5f*(im[k] - im[half - k]);
+      const float oddRe = 0.5f*(im[k] + im[half - k]);
+      const float oddIm = -0.5f*(re[k] - re[half - k]);
+      const float xRe = evenRe + oddRe*untangleRe[k] - oddIm*untangleIm[k];
+      const float xIm = evenIm + oddRe*untangleIm[k] + oddIm*untangleRe[k];
+      out[k] = std::sqrt(xRe*xRe + xIm*xIm);
+    }
+  }
+
+private:
+  const unsigned int half;
+  vector<unsigned int> reversed;
+  vector<float> twiddleRe;
+  vector<float> twiddleIm;
+  vector<float> untangleRe;
+  vector<float> untangleIm;
+  vector<float> re;
+  vector<float> im;
+};
+
+}
+
+OnsetDetector::OnsetDetector(const Wave &wave) : wave(wave) {
+}
+
+/* Spectral flux of hops [firstHop, lastHop) into out. Hop h is the
+ * window centered on frame h*hopSize. */
+void OnsetDetector::flux(unsigned long firstHop, unsigned long lastHop, float *out) const {
+  const unsigned int bins = fftSize/2 + 1;
+  const auto channels = wave.channels;
+  const long frames = wave.samples.size() / channels;
+
+  RealFft fft(fftSize);
+  vector<float> window(fftSize);
+  for(unsigned int i=0; i < fftSize; ++i) {
+    window[i] = (0.5 - 0.5*cos(2*M_PI*i/fftSize)) / channels;
+  }
+  vector<float> frame(fftSize);
+  vector<float> previous(bins, 0.f);
+  vector<float> current(bins);
+
+  // the first hop is compared with the one before it, or with silence
+  for(auto h = firstHop ? firstHop - 1 : firstHop; h < lastHop; ++h) {
+    // the part of the window inside the wave
+    const long start = static_cast<long>(h*hopSize) - fftSize/2;
+    const long from = std::max(0l, -start);
+    const long to = std::min<long>(fftSize, frames - start);
+    std::fill(frame.begin(), frame.end(), 0.f);
+    for(long i=from; i < to; ++i) {
+      const float *x = &wave.samples[(start + i)*channels];
+      float sum = 0.f;
+      for(unsigned int c=0; c < channels; ++c) {
+        sum += x[c];
+      }
+      frame[i] = window[i] * sum;
+    }
+    fft.magnitudes(frame.data(), current.data());
+
+    for(unsigned int k=0; k < bins; ++k) {
+      current[k] = fastLog1p(compression * current[k]);
+    }
+    float growth = 0.f;
+    for(unsigned int k=0; k < bins; ++k) {
+      growth += std::max(0.f, current[k] - previous[k]);
+    }
+    if (h >= firstHop) {
+      out[h - firstHop] = growth;
+    }
+    std::swap(previous, current);
+  }
+}
+
+vector<float> OnsetDetector::envelope(unsigned int threads) const {
+  const unsigned long frames = wave.samples.size() / wave.channels;
+  if (!frames) {
+    return vector<float>();
+  }
+  const unsigned long hops = frames/hopSize + 1;
+
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // chunks of at least a second or so, the threads have to redo the
+  // hop before their chunk
+  threads = std::min<unsigned long>(threads, hops/128 + 1);
+
+  vector<float> f(hops);
+  vector<std::thread> pool;
+  const auto chunk = (hops + threads - 1) / threads;
+  for(unsigned long first=0; first < hops; first += chunk) {
+    pool.emplace_back(&OnsetDetector::flux, this, first, std::min(first + chunk, hops), &f[first]);
+  }
+  for(auto &t : pool) {
+    t.join();
+  }
+
+  // normalize, so that thresholds don't depend on the level of the
+  // recording
+  double mean = 0., var = 0.;
+  for(auto v : f) {
+    mean += v;
+  }
+  mean /= hops;
+  for(auto v : f) {
+    var += (v - mean)*(v - mean);
+  }
+  const double deviation = sqrt(var/hops);
+  if (deviation <= 0.) {
+    return vector<float>();
+  }
+  for(auto &v : f) {
+    v = (v - mean) / deviation;
+  }
+  return f;
+}
+
+vector<unsigned int> OnsetDetector::detect(double sensitivity, unsigned int threads) const {
+  vector<unsigned int> onsets;
+  const auto f = envelope(threads);
+  const long hops = f.size();
+  const unsigned long frames = wave.samples.size() / wave.channels;
+
+  vector<double> sums(hops + 1, 0.);
+  for(long h=0; h < hops; ++h) {
+    sums[h + 1] = sums[h] + f[h];
+  }
+
+  const double hopSeconds = static_cast<double>(hopSize) / wave.samplerate;
+  const long gap = std::max(1l, lround(minGap / hopSeconds));
+  const long before = std::max(1l, lround(meanBefore / hopSeconds));
+  const long after = std::max(1l, lround(meanAfter / hopSeconds));
+  // how far a peak has to rise above the local mean, in deviations
+  const double delta = 0.1 + 2.9*(1. - std::min(1., std::max(0., sensitivity)));
+
+  long last = -gap;
+  for(long h=0; h < hops; ++h) {
+    const long from = std::max(0l, h - gap);
+    const long to = std::min<long>(hops, h + gap + 1);
+    if (f[h] < *std::max_element(&f[from], &f[to - 1] + 1)) {
+      continue;
+    }
+    const long meanFrom = std::max(0l, h - before);
+    const long meanTo = std::min<long>(hops, h + after + 1);
+    const double localMean = (sums[meanTo] - sums[meanFrom]) / (meanTo - meanFrom);
+    if (f[h] > localMean + delta && h - last >= gap) {
+      onsets.push_back(std::min<unsigned long>(h*hopSize, frames - 1));
+      last = h;
+    }
+  }
+  return onsets;
+}
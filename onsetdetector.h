@@ -0,0 +1,39 @@
+#ifndef ONSETDETECTOR_H
+#define ONSETDETECTOR_H
+
+#include <vector>
+
+class Wave;
+
+/* Finds the onsets of hits and notes in a Wave, to place cuts at. The
+ * detection function is the spectral flux of the mixed down channels:
+ * how much the log magnitude spectrum grows from one hop to the next.
+ * Onsets are its peaks above a threshold that follows the local mean,
+ * so loud and quiet passages are treated alike.
+ *
+ * The spectra are computed in parallel, one chunk of hops per thread;
+ * picking the peaks is cheap and done afterwards. */
+class OnsetDetector {
+
+public:
+  static const unsigned int fftSize = 1024;
+  static const unsigned int hopSize = 256;
+
+  OnsetDetector(const Wave &wave);
+
+  // frames of the onsets, ascending. sensitivity runs from 0 (only the
+  // strongest onsets) to 1 (anything that stands out from the noise);
+  // threads: 0 to use one per core
+  std::vector<unsigned int> detect(double sensitivity=0.5, unsigned int threads=0) const;
+  // the detection function: spectral flux of hop h, the window
+  // centered on frame h*hopSize, normalized to zero mean and unit
+  // variance; empty for a silent wave
+  std::vector<float> envelope(unsigned int threads=0) const;
+
+private:
+  const Wave &wave;
+
+  void flux(unsigned long firstHop, unsigned long lastHop, float *out) const;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "pcmquantizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const unsigned int PcmQuantizer::lanes;
+
+// error feedback filter of the noise shaping, newest error first: a
+// three tap approximation of an E-weighted (inverse hearing threshold)
+// noise spectrum at 44.1 and 48 kHz, after Wannamaker
+static const float shape[3] = {1.623f, -0.982f, 0.109f};
+// largest error fed back, in LSB: when the signal clips, the error
+// isn't quantization noise and would make the filter ring
+static const float maxError = 2.f;
+// 2^-24: a generator output, shifted down to 24 bits, as a fraction
+static const float unit = 1.f/16777216;
+
+static inline uint32_t xorshift(uint32_t x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+/* TPDF dither in LSB, (-1, 1), from two draws of a generator */
+static inline float tpdf(uint32_t &s) {
+  s = xorshift(s);
+  const int32_t a = s >> 8;
+  s = xorshift(s);
+  const int32_t b = s >> 8;
+  return static_cast<float>(a - b) * unit;
+}
+
+/* v rounded to the nearest integer, ties to even like the kernels.
+ * lrintf() is a call without SSE4.1. */
+static inline int32_t roundToInt(float v) {
+#if defined(__x86_64__)
+  return _mm_cvtss_si32(_mm_set_ss(v));
+#else
+  return lrintf(v);
+#endif
+}
+
+static inline int32_t toInt(int32_t q, unsigned int shift) {
+  return static_cast<int32_t>(static_cast<uint32_t>(q) << shift);
+}
+
+/* The kernels: out[i] = in[i]*scale plus dither, clipped to [-limit-1,
+ * limit], rounded to the nearest integer and shifted up. Sample i takes
+ * its dither from generator i % lanes, in the same order of operations
+ * in every kernel, so that they agree to the bit. */
+static void convertScalar(const float *in, unsigned long n, float scale, float limit,
+                          bool dither, uint32_t *state, unsigned int shift, int32_t *out) {
+  const auto lanes = PcmQuantizer::lanes;
+  for(unsigned long i=0; i < n; ++i) {
+    float v = in[i]*scale;
+    if (dither) {
+      v += tpdf(state[i % lanes]);
+    }
+    v = std::min(std::max(v, -limit - 1.f), limit);
+    out[i] = toInt(roundToInt(v), shift);
+  }
+}
+
+#if defined(__x86_64__)
+static inline __m128i xorshift4(__m128i x) {
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+static inline __m128 tpdf4(__m128i &s) {
+  s = xorshift4(s);
+  const __m128i a = _mm_srli_epi32(s, 8);
+  s = xorshift4(s);
+  const __m128i b = _mm_srli_epi32(s, 8);
+  return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(a, b)), _mm_set1_ps(unit));
+}
+
+static void convertSse(const float *in, unsigned long n, float scale, float limit,
+                       bool dither, uint32_t *state, unsigned int shift, int32_t *out) {
+  // generators 0-3 and 4-7
+  __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+  __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state + 4));
+  const __m128 vScale = _mm_set1_ps(scale);
+  const __m128 lo = _mm_set1_ps(-limit - 1.f);
+  const __m128 hi = _mm_set1_ps(limit);
+  const __m128i vShift = _mm_cvtsi32_si128(shift);
+  unsigned long i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m128 v0 = _mm_mul_ps(_mm_loadu_ps(in + i), vScale);
+    __m128 v1 = _mm_mul_ps(_mm_loadu_ps(in + i + 4), vScale);
+    if (dither) {
+      v0 = _mm_add_ps(v0, tpdf4(s0));
+      v1 = _mm_add_ps(v1, tpdf4(s1));
+    }
+    v0 = _mm_min_ps(_mm_max_ps(v0, lo), hi);
+    v1 = _mm_min_ps(_mm_max_ps(v1, lo), hi);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_sll_epi32(_mm_cvtps_epi32(v0), vShift));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 4), _mm_sll_epi32(_mm_cvtps_epi32(v1), vShift));
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state), s0);
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(state + 4), s1);
+  convertScalar(in + i, n - i, scale, limit, dither, state, shift, out + i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift8(__m256i x) {
+  x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+  x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+  return _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+}
+
+__attribute__((target("avx2")))
+static void convertAvx2(const float *in, unsigned long n, float scale, float limit,
+                        bool dither, uint32_t *state, unsigned int shift, int32_t *out) {
+  __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state));
+  const __m256 vScale = _mm256_set1_ps(scale);
+  const __m256 lo = _mm256_set1_ps(-limit - 1.f);
+  const __m256 hi = _mm256_set1_ps(limit);
+  const __m256 vUnit = _mm256_set1_ps(unit);
+  const __m128i vShift = _mm_cvtsi32_si128(shift);
+  unsigned long i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_mul_ps(_mm256_loadu_ps(in + i), vScale);
+    if (dither) {
+      s = xorshift8(s);
+      const __m256i a = _mm256_srli_epi32(s, 8);
+      s = xorshift8(s);
+      const __m256i b = _mm256_srli_epi32(s, 8);
+      v = _mm256_add_ps(v, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(a, b)), vUnit));
+    }
+    v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), _mm256_sll_epi32(_mm256_cvtps_epi32(v), vShift));
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(state), s);
+  convertScalar(in + i, n - i, scale, limit, dither, state, shift, out + i);
+}
+#endif
+
+PcmQuantizer::PcmQuantizer(unsigned int channels, unsigned int bits, bool dither,
+                           bool noiseShaping, uint32_t seed) :
+  channels(channels), bits(bits), dither(dither), noiseShaping(noiseShaping), gain(1.f),
+  scale(ldexpf(1.f, bits - 1)), limit(scale - 1.f), shift(32 - bits),
+  errors(3*channels, 0.f) {
+  if (bits != 16 && bits != 24) {
+    throw std::invalid_argument("PcmQuantizer: 16 or 24 bits only");
+  }
+  // distinct, non-zero seeds for the generators
+  for(unsigned int l=0; l < lanes; ++l) {
+    state[l] = xorshift(seed*2654435761u + l*40503u + 1u);
+    if (!state[l]) {
+      state[l] = 1;
+    }
+  }
+
+  kernel = convertScalar;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  kernel = __builtin_cpu_supports("avx2") ? convertAvx2 : convertSse;
+#endif
+}
+
+void PcmQuantizer::convert(const float *in, unsigned long n, int32_t *out) {
+  if (noiseShaping) {
+    convertShaped(in, n, out);
+  } else {
+    kernel(in, n, gain*scale, limit, dither, state, shift, out);
+  }
+}
+
+/* With noise shaping, the error of each sample is filtered into the next
+ * ones of its channel: a recursion per channel, frame by frame. */
+void PcmQuantizer::convertShaped(const float *in, unsigned long n, int32_t *out) {
+  // the dither of the block first, lane by lane like the kernels: this
+  // part vectorizes
+  noise.assign(n, 0.f);
+  if (dither) {
+    unsigned long i = 0;
+    for(; i + lanes <= n; i += lanes) {
+      for(unsigned int l=0; l < lanes; ++l) {
+        noise[i + l] = tpdf(state[l]);
+      }
+    }
+    for(unsigned int l=0; i < n; ++i, ++l) {
+      noise[i] = tpdf(state[l]);
+    }
+  }
+  const float s = gain*scale;
+  for(unsigned long i=0; i < n; i += channels) {
+    for(unsigned int c=0; c < channels; ++c) {
+      float *e = &errors[3*c];
+      const float v = in[i + c]*s - (shape[0]*e[0] + shape[1]*e[1] + shape[2]*e[2]);
+      const int32_t q = roundToInt(std::min(std::max(v + noise[i + c], -limit - 1.f), limit));
+      e[2] = e[1];
+      e[1] = e[0];
+      e[0] = std::min(std::max(q - v, -maxError), maxError);
+      out[i + c] = toInt(q, shift);
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef PCMQUANTIZER_H
+#define PCMQUANTIZER_H
+
+#include <cstdint>
+#include <vector>
+
+/* The last stage of an export: float samples to 16 or 24 bit PCM,
+ * after a gain. TPDF dither, the difference of two uniform values of
+ * one LSB, keeps the quantization error independent of the signal;
+ * noise shaping feeds the error back through a filter that moves it
+ * towards the top of the band, where the ear is least sensitive.
+ *
+ * Without noise shaping, the gain, dither, rounding and clipping run
+ * in SSE2 or AVX2 kernels. The dither comes from 8 xorshift generators
+ * side by side, so that all kernels give the same samples. Noise
+ * shaping is a recursion along each channel and runs per frame, with
+ * the dither still generated a block at a time. */
+class PcmQuantizer {
+
+public:
+  // bits: 16 or 24; throws std::invalid_argument otherwise
+  PcmQuantizer(unsigned int channels, unsigned int bits, bool dither=true,
+               bool noiseShaping=false, uint32_t seed=1);
+
+  void setGain(float g) { gain = g; }
+  // n interleaved samples to ints with full scale at 2^31, the scale of
+  // libsndfile's int I/O, and the low bits zero
+  void convert(const float *in, unsigned long n, int32_t *out);
+
+  // the xorshift generators, one per lane
+  static const unsigned int lanes = 8;
+
+private:
+  const unsigned int channels;
+  const unsigned int bits;
+  const bool dither;
+  const bool noiseShaping;
+  float gain;
+  const float scale; // full scale, in LSB
+  const float limit; // largest sample
+  const unsigned int shift; // to the scale of libsndfile
+  uint32_t state[lanes];
+  // shaping: the last errors of each channel, newest first
+  std::vector<float> errors;
+  std::vector<float> noise; // dither for the shaped path
+
+  typedef void (*Kernel)(const float *in, unsigned long n, float scale, float limit,
+                         bool dither, uint32_t *state, unsigned int shift, int32_t *out);
+  Kernel kernel; // picked for the CPU
+  void convertShaped(const float *in, unsigned long n, int32_t *out);
+};
+
+#endif
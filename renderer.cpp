@@ -0,0 +1,109 @@
+#include "renderer.h"
+#include "jackplayer.h"
+#include "nullbackend.h"
+#include "wave.h"
+
+#include <sndfile.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+using std::pair;
+
+typedef std::chrono::steady_clock Clock;
+
+// large periods: there is no latency to worry about offline
+static const unsigned int renderPeriod = 4096;
+
+Renderer::Renderer(std::shared_ptr<const Wave> wave, unsigned int sampleRate) :
+  wave(wave), sampleRate(sampleRate ? sampleRate : wave->samplerate) {
+}
+
+unsigned long Renderer::outputFrames(unsigned int start, unsigned int end) const {
+  return end > start ? lround((end - start) * static_cast<double>(sampleRate) / wave->samplerate) : 0;
+}
+
+/* A player on a Manual NullBackend, with our wave loaded. */
+class RenderSession {
+
+public:
+  RenderSession(const std::shared_ptr<const Wave> &wave, unsigned int sampleRate,
+                const string &fileName) :
+    backend(new NullBackend(sampleRate, renderPeriod, NullBackend::Manual)),
+    player(0, wave->channels, backend),
+    channels(wave->channels),
+    outFile(fileName.c_str(), SFM_WRITE, SF_FORMAT_WAV | SF_FORMAT_FLOAT, wave->channels, sampleRate),
+    written(0),
+    startTime(Clock::now()) {
+    if (!outFile) {
+      throw std::runtime_error("Error opening file " + fileName);
+    }
+    // offline, page faults don't cause dropouts
+    player.setMemoryLockBudget(0);
+    if (!player.loadWave(wave)) {
+      throw std::runtime_error("Can't load wave for rendering");
+    }
+    // one period to let the process thread pick up the wave
+    backend->run(1);
+  }
+
+  // run one period, and write at most maxFrames of its output
+  unsigned long runPeriod(unsigned long maxFrames) {
+    backend->capture(channels);
+    backend->run(renderPeriod);
+    const auto &output = backend->output();
+    auto n = std::min<unsigned long>(output.size()/channels, maxFrames);
+    outFile.writef(output.data(), n);
+    written += n;
+    return n;
+  }
+
+  RenderResult result() const {
+    RenderResult r;
+    r.frames = written;
+    r.seconds = std::chrono::duration<double>(Clock::now() - startTime).count();
+    r.realtimeFactor = r.seconds > 0. ? (static_cast<double>(written)/backend->sampleRate()) / r.seconds : 0.;
+    return r;
+  }
+
+  NullBackend *backend; // owned by player
+  JackPlayer player;
+
+private:
+  const unsigned int channels;
+  SndfileHandle outFile;
+  unsigned long written;
+  Clock::time_point startTime;
+};
+
+RenderResult Renderer::renderLoop(const string &fileName,
+                                  unsigned int start, unsigned int end, unsigned int repeats) const {
+  RenderSession session(wave, sampleRate, fileName);
+
+  session.player.loop(start, end);
+
+  const auto total = repeats * outputFrames(start, end);
+  for(unsigned long done = 0; done < total; ) {
+    done += session.runPeriod(total - done);
+  }
+  return session.result();
+}
+
+RenderResult Renderer::renderRegions(const string &fileName,
+                                     const vector<pair<unsigned int, unsigned int> > &regions) const {
+  RenderSession session(wave, sampleRate, fileName);
+
+  for(auto &region : regions) {
+    session.player.play(region.first, region.second);
+    const auto total = outputFrames(region.first, region.second);
+    unsigned long done = 0;
+    do {
+      done += session.runPeriod(total - done);
+    } while (done < total && session.player.playState() != STOPPED);
+  }
+  return session.result();
+}
@@ -0,0 +1,42 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Wave;
+
+struct RenderResult {
+  unsigned long frames; // frames written
+  double seconds; // wall clock time
+  double realtimeFactor; // seconds of audio rendered per second
+};
+
+/* Bounces regions of a Wave to a WAV file, by running a JackPlayer on
+ * a NullBackend as fast as possible. Output goes through the same
+ * engine as playback, so resampling and loop handling are identical.
+ * Regions are given in frames, like JackPlayer::play(). */
+class Renderer {
+
+public:
+  // sampleRate: rate of the output file, 0 to use the rate of the wave.
+  // The players of the renders share the wave: it isn't copied.
+  Renderer(std::shared_ptr<const Wave> wave, unsigned int sampleRate=0);
+
+  // render the loop (start, end) 'repeats' times
+  RenderResult renderLoop(const std::string &fileName,
+                          unsigned int start, unsigned int end, unsigned int repeats) const;
+  // render each region once, in order
+  RenderResult renderRegions(const std::string &fileName,
+                             const std::vector<std::pair<unsigned int, unsigned int> > &regions) const;
+
+private:
+  const std::shared_ptr<const Wave> wave;
+  const unsigned int sampleRate;
+
+  unsigned long outputFrames(unsigned int start, unsigned int end) const;
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include "resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const unsigned int PolyphaseFilter::taps;
+const unsigned int PolyphaseFilter::maxPhases;
+
+// stopband attenuation of the filter, in dB
+static const double attenuation = 96.;
+// input frames a Resampler takes from data_in at a time
+static const unsigned int blockFrames = 256;
+// the SIMD kernels handle up to this many channels
+static const unsigned int maxSimdChannels = 8;
+// and need lanes for lcm(8, channels) floats
+static const unsigned int maxPeriod = 8*maxSimdChannels;
+
+/* Modified Bessel function of the first kind, order 0, for the Kaiser
+ * window. */
+static double besselI0(double x) {
+  double sum = 1., term = 1.;
+  for(int k=1; term > 1e-12*sum; ++k) {
+    term *= (x/(2*k)) * (x/(2*k));
+    sum += term;
+  }
+  return sum;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+  while (b) {
+    const auto t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* The kernels: out[c] = sum of h[i]*x[i] over the i with i % channels
+ * == c, for i < n. period is the least common multiple of the vector
+ * width and channels, n a multiple of period: then every lane of the
+ * accumulators only ever sees one channel. */
+static void kernelScalar(const float *h, const float *x, unsigned int n,
+                         unsigned int, unsigned int channels, float *out) {
+  std::fill(out, out + channels, 0.f);
+  for(unsigned int i=0; i < n; i += channels) {
+    for(unsigned int c=0; c < channels; ++c) {
+      out[c] += h[i + c] * x[i + c];
+    }
+  }
+}
+
+#if defined(__x86_64__)
+static inline void sumLanes(const float *lanes, unsigned int period,
+                            unsigned int channels, float *out) {
+  std::fill(out, out + channels, 0.f);
+  unsigned int c = 0;
+  for(unsigned int l=0; l < period; ++l) {
+    out[c] += lanes[l];
+    if (++c == channels) {
+      c = 0;
+    }
+  }
+}
+
+static void kernelSse(const float *h, const float *x, unsigned int n,
+                      unsigned int period, unsigned int channels, float *out) {
+  float lanes[maxPeriod];
+  if (period == 4) {
+    // mono, stereo or quad: two accumulators to hide the add latency
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for(unsigned int i=0; i < n; i += 8) {
+      acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(h + i), _mm_loadu_ps(x + i)));
+      acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+    }
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+  } else {
+    __m128 acc[maxPeriod/4];
+    const unsigned int k = period/4;
+    for(unsigned int j=0; j < k; ++j) {
+      acc[j] = _mm_setzero_ps();
+    }
+    for(unsigned int i=0; i < n; i += period) {
+      for(unsigned int j=0; j < k; ++j) {
+        acc[j] = _mm_add_ps(acc[j], _mm_mul_ps(_mm_loadu_ps(h + i + 4*j), _mm_loadu_ps(x + i + 4*j)));
+      }
+    }
+    for(unsigned int j=0; j < k; ++j) {
+      _mm_storeu_ps(lanes + 4*j, acc[j]);
+    }
+  }
+  sumLanes(lanes, period, channels, out);
+}
+
+__attribute__((target("avx2,fma")))
+static void kernelAvx2(const float *h, const float *x, unsigned int n,
+                       unsigned int period, unsigned int channels, float *out) {
+  float lanes[maxPeriod];
+  if (period == 8) {
+    // up to 8 channels: two accumulators to hide the FMA latency
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    unsigned int i = 0;
+    for(; i + 16 <= n; i += 16) {
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i), acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(h + i + 8), _mm256_loadu_ps(x + i + 8), acc1);
+    }
+    if (i < n) {
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(h + i), _mm256_loadu_ps(x + i), acc0);
+    }
+    const __m256 acc = _mm256_add_ps(acc0, acc1);
+    if (4 % channels == 0) {
+      // fold the lanes in registers, down to one per channel
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+      if (channels < 4) {
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      }
+      if (channels == 1) {
+        sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+      }
+      _mm_storeu_ps(lanes, sum);
+      std::copy(lanes, lanes + channels, out);
+      return;
+    }
+    _mm256_storeu_ps(lanes, acc);
+  } else {
+    __m256 acc[maxPeriod/8];
+    const unsigned int k = period/8;
+    for(unsigned int j=0; j < k; ++j) {
+      acc[j] = _mm256_setzero_ps();
+    }
+    for(unsigned int i=0; i < n; i += period) {
+      for(unsigned int j=0; j < k; ++j) {
+        acc[j] = _mm256_fmadd_ps(_mm256_loadu_ps(h + i + 8*j), _mm256_loadu_ps(x + i + 8*j), acc[j]);
+      }
+    }
+    for(unsigned int j=0; j < k; ++j) {
+      _mm256_storeu_ps(lanes + 8*j, acc[j]);
+    }
+  }
+  sumLanes(lanes, period, channels, out);
+}
+#endif
+
+std::shared_ptr<const PolyphaseFilter> PolyphaseFilter::create(unsigned int inRate, unsigned int outRate,
+                                                               unsigned int channels) {
+  if (!inRate || !outRate || inRate == outRate || !channels) {
+    return nullptr;
+  }
+  const auto g = gcd(inRate, outRate);
+  if (outRate/g > maxPhases) {
+    return nullptr;
+  }
+  return std::shared_ptr<const PolyphaseFilter>(new PolyphaseFilter(outRate/g, inRate/g, channels));
+}
+
+PolyphaseFilter::PolyphaseFilter(unsigned int up, unsigned int down, unsigned int channels) :
+  up(up), down(down), channels(channels), step(down/up), remainder(down%up),
+  coefs(up*taps*channels) {
+  // transition band for the attenuation, from Kaiser's formula, in
+  // cycles per input frame; it ends at the lower of the two Nyquist
+  // frequencies, so nothing folds back into the passband
+  const double transition = (attenuation - 7.95) / (2.285 * 2*M_PI * taps);
+  const double cutoff = 0.5*std::min(1., static_cast<double>(up)/down) - transition/2;
+  const double beta = 0.1102 * (attenuation - 8.7);
+  const double halfWidth = taps/2;
+
+  // tap i of phase p is at frame i of the window, the output at frame
+  // taps/2 - 1 + p/up
+  std::vector<double> h(taps);
+  for(unsigned int p=0; p < up; ++p) {
+    double sum = 0.;
+    for(unsigned int i=0; i < taps; ++i) {
+      const double t = i - (halfWidth - 1) - static_cast<double>(p)/up;
+      const double r = t/halfWidth;
+      const double window = besselI0(beta * std::sqrt(std::max(0., 1. - r*r))) / besselI0(beta);
+      const double x = 2*M_PI*cutoff*t;
+      h[i] = window * (x == 0. ? 2*cutoff : std::sin(x)/(M_PI*t));
+      sum += h[i];
+    }
+    // unity gain at DC in every phase
+    for(unsigned int i=0; i < taps; ++i) {
+      std::fill_n(&coefs[(p*taps + i)*channels], channels, static_cast<float>(h[i]/sum));
+    }
+  }
+
+  kernel = kernelScalar;
+  period = channels;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (channels <= maxSimdChannels) {
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+      kernel = kernelAvx2;
+      period = 8/gcd(8, channels)*channels;
+    } else {
+      kernel = kernelSse;
+      period = 4/gcd(4, channels)*channels;
+    }
+  }
+#endif
+}
+
+Resampler::Resampler(unsigned int channels, std::shared_ptr<const PolyphaseFilter> filter) :
+  nChannels(channels), filter(filter),
+  window(filter ? (PolyphaseFilter::taps + blockFrames)*channels : 0) {
+  int error = 0;
+  src = SRC_STATE_ptr(src_new(SRC_SINC_FASTEST, channels, &error));
+  if (error) {
+    throw std::runtime_error(src_strerror(error) );
+  }
+  reset();
+}
+
+void Resampler::reset(void) {
+  src_reset(src.get());
+  // silence before the first frame, so that the first output is
+  // centered on it
+  fill = PolyphaseFilter::taps/2 - 1;
+  std::fill(window.begin(), window.begin() + std::min<size_t>(fill*nChannels, window.size()), 0.f);
+  base = 0;
+  phase = 0;
+}
+
+int Resampler::process(SRC_DATA &data) {
+  if (!filter || data.src_ratio != filter->ratio()) {
+    return src_process(src.get(), &data);
+  }
+
+  const auto channels = nChannels;
+  const auto taps = PolyphaseFilter::taps;
+  long used = 0;
+  long gen = 0;
+  while (true) {
+    while (gen < data.output_frames && base + taps <= fill) {
+      filter->apply(phase, &window[base*channels], data.data_out + gen*channels);
+      ++gen;
+      base += filter->step;
+      phase += filter->remainder;
+      if (phase >= filter->up) {
+        phase -= filter->up;
+        ++base;
+      }
+    }
+    if (gen == data.output_frames || used == data.input_frames) {
+      break;
+    }
+    // drop the frames the filter is done with, and take more input
+    std::copy(window.begin() + base*channels, window.begin() + fill*channels, window.begin());
+    fill -= base;
+    base = 0;
+    const auto n = std::min<long>(data.input_frames - used, window.size()/channels - fill);
+    std::copy(data.data_in + used*channels, data.data_in + (used + n)*channels,
+              window.begin() + fill*channels);
+    fill += n;
+    used += n;
+  }
+  data.input_frames_used = used;
+  data.output_frames_gen = gen;
+  return 0;
+}
@@ -0,0 +1,86 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <samplerate.h>
+
+#include <memory>
+#include <vector>
+
+struct Free_SRC_STATE {
+public:
+  void operator() (SRC_STATE *p) { src_delete(p); }
+};
+
+typedef std::unique_ptr<SRC_STATE, Free_SRC_STATE> SRC_STATE_ptr;
+
+/* Kaiser windowed sinc for converting between two rates with a small
+ * rational ratio up/down, e.g. 160/147 from 44.1 kHz to 48 kHz, as a
+ * table of 'up' phases of 'taps' coefficients. Every coefficient is
+ * stored once per channel, so that a phase lines up with a window of
+ * interleaved frames, and the kernels are plain vector multiply-adds.
+ * Immutable once created: Resamplers can share one. */
+class PolyphaseFilter {
+
+public:
+  static const unsigned int taps = 64;
+  // bounds the size of the table, e.g. 11.025 kHz to 48 kHz needs 640
+  static const unsigned int maxPhases = 640;
+
+  // null if inRate and outRate are equal, or their ratio needs too
+  // many phases
+  static std::shared_ptr<const PolyphaseFilter> create(unsigned int inRate, unsigned int outRate,
+                                                       unsigned int channels);
+
+  const unsigned int up;
+  const unsigned int down;
+  const unsigned int channels;
+  // frames and phases an output frame moves the filter by
+  const unsigned int step;
+  const unsigned int remainder;
+
+  double ratio() const { return static_cast<double>(up)/down; }
+  // one output frame at phase p, from the 'taps' frames at x
+  void apply(unsigned int p, const float *x, float *out) const {
+    kernel(&coefs[p*taps*channels], x, taps*channels, period, channels, out);
+  }
+
+private:
+  PolyphaseFilter(unsigned int up, unsigned int down, unsigned int channels);
+
+  typedef void (*Kernel)(const float *h, const float *x, unsigned int n,
+                         unsigned int period, unsigned int channels, float *out);
+  std::vector<float> coefs;
+  Kernel kernel; // picked for the channel count and the CPU
+  unsigned int period; // floats that the kernel accumulates separately
+};
+
+/* Sample rate converter with the semantics of libsamplerate's
+ * src_process(). Converts with the PolyphaseFilter, if there is one and
+ * it has the ratio asked for, and with SRC_SINC_FASTEST otherwise.
+ * Allocates in the constructor only: process() and reset() are RT
+ * safe. */
+class Resampler {
+
+public:
+  // throws std::runtime_error if libsamplerate fails
+  Resampler(unsigned int channels, std::shared_ptr<const PolyphaseFilter> filter=nullptr);
+
+  // returns a libsamplerate error, or 0; end_of_input is ignored
+  int process(SRC_DATA &data);
+  void reset();
+
+private:
+  const unsigned int nChannels;
+  SRC_STATE_ptr src;
+  std::shared_ptr<const PolyphaseFilter> filter;
+  // filter input: the frames before 'base' that the next outputs need,
+  // and what we took from data_in so far
+  std::vector<float> window;
+  unsigned long fill; // frames in window
+  unsigned long base; // first frame under the filter
+  unsigned int phase;
+};
+
+typedef std::unique_ptr<Resampler> Resampler_ptr;
+
+#endif
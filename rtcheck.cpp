@@ -0,0 +1,149 @@
+#include "rtcheck.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc's own allocator entry points, so that we don't need dlsym()
+// (which allocates) to forward malloc and friends
+extern "C" {
+  void *__libc_malloc(size_t size);
+  void *__libc_calloc(size_t n, size_t size);
+  void *__libc_realloc(void *p, size_t size);
+  void *__libc_memalign(size_t alignment, size_t size);
+  void __libc_free(void *p);
+}
+
+static thread_local unsigned int depth = 0; // nesting of Scopes on this thread
+static thread_local bool reporting = false;
+static std::atomic<unsigned long> nViolations(0);
+
+// the real functions, looked up on first use. Plain pointers rather
+// than function statics: the guard of a static may lock a mutex.
+// Condition variables aren't interposed (their symbols are versioned),
+// but waiting on one needs a locked mutex.
+static int (*realMutexLock)(pthread_mutex_t *) = nullptr;
+static int (*realSemWait)(sem_t *) = nullptr;
+static ssize_t (*realWrite)(int, const void *, size_t) = nullptr;
+static int (*realNanosleep)(const struct timespec *, struct timespec *) = nullptr;
+static int (*realUsleep)(useconds_t) = nullptr;
+
+template<typename F> static F lookup(F &f, const char *name) {
+  if (f == nullptr) {
+    f = reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+  }
+  return f;
+}
+
+static void writeString(const char *s) {
+  lookup(realWrite, "write")(2, s, strlen(s));
+}
+
+static void report(const char *function) {
+  reporting = true;
+  ++nViolations;
+  writeString("RT check: ");
+  writeString(function);
+  writeString(" called in process()\n");
+  void *frames[32];
+  const int n = backtrace(frames, 32);
+  backtrace_symbols_fd(frames, n, 2);
+  if (getenv("RTCHECK_ABORT")) {
+    abort();
+  }
+  reporting = false;
+}
+
+static inline void check(const char *function) {
+  if (depth && !reporting) {
+    report(function);
+  }
+}
+
+__attribute__ ((constructor)) static void init(void) {
+  // the first backtrace() loads libgcc, which allocates
+  void *frame;
+  backtrace(&frame, 1);
+}
+
+RtCheck::Scope::Scope() {
+  ++depth;
+}
+
+RtCheck::Scope::~Scope() {
+  --depth;
+}
+
+unsigned long RtCheck::violations(void) {
+  return nViolations;
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+  check("malloc");
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+  check("calloc");
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+  check("realloc");
+  return __libc_realloc(p, size);
+}
+
+int posix_memalign(void **p, size_t alignment, size_t size) {
+  check("posix_memalign");
+  *p = __libc_memalign(alignment, size);
+  return *p ? 0 : ENOMEM;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  check("aligned_alloc");
+  return __libc_memalign(alignment, size);
+}
+
+void free(void *p) {
+  if (p) {
+    check("free");
+  }
+  __libc_free(p);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *m) {
+  check("pthread_mutex_lock");
+  return lookup(realMutexLock, "pthread_mutex_lock")(m);
+}
+
+int sem_wait(sem_t *s) {
+  check("sem_wait");
+  return lookup(realSemWait, "sem_wait")(s);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  check("write");
+  return lookup(realWrite, "write")(fd, buf, count);
+}
+
+int nanosleep(const struct timespec *t, struct timespec *rem) {
+  check("nanosleep");
+  return lookup(realNanosleep, "nanosleep")(t, rem);
+}
+
+int usleep(useconds_t usec) {
+  check("usleep");
+  return lookup(realUsleep, "usleep")(usec);
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef RTCHECK_H
+#define RTCHECK_H
+
+/* RT-safety checker, built with 'qmake CONFIG+=rtcheck', which defines
+ * RT_CHECK. It interposes the allocation, locking and blocking
+ * functions of the C library. Any call to them on a thread inside an
+ * RtCheck::Scope, i.e. inside process(), is reported on stderr with a
+ * backtrace. Set RTCHECK_ABORT in the environment to abort on the first
+ * report instead. */
+class RtCheck {
+
+public:
+  class Scope {
+  public:
+    Scope();
+    ~Scope();
+  };
+
+  // number of calls reported so far
+  static unsigned long violations();
+};
+
+#ifdef RT_CHECK
+#define RT_CHECK_SCOPE RtCheck::Scope rtCheckScope
+#else
+#define RT_CHECK_SCOPE
+#endif
+
+// Drive the engine through a NullBackend for 'periods' periods,
+// exercising all commands, MIDI triggers, routing and wave swaps, and
+// streaming from 'streamFile' if it isn't empty. Returns 0 if nothing
+// was reported.
+int rtStress(unsigned long periods, const char *streamFile);
+
+#endif
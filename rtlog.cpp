@@ -0,0 +1,38 @@
+#include "rtlog.h"
+
+#include <QDebug>
+
+void RtLog::push(const char *message, const char *detail, unsigned int nValues, long a, long b) {
+  Record r;
+  r.message = message;
+  r.detail = detail;
+  r.nValues = nValues;
+  r.values[0] = a;
+  r.values[1] = b;
+  if (!records.push(r)) {
+    nDropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+unsigned int RtLog::flush(void) {
+  unsigned int n = 0;
+  Record r;
+  while (records.pop(r) ) {
+    auto d = qDebug();
+    d << r.message;
+    if (r.detail) {
+      d << r.detail;
+    }
+    for(unsigned int i=0; i < r.nValues && i < 2; ++i) {
+      d << r.values[i];
+    }
+    ++n;
+  }
+
+  const auto lost = dropped();
+  if (lost != reportedDropped) {
+    qDebug() << "RtLog:" << lost - reportedDropped << "messages dropped";
+    reportedDropped = lost;
+  }
+  return n;
+}
@@ -0,0 +1,47 @@
+#ifndef RTLOG_H
+#define RTLOG_H
+
+#include <atomic>
+
+#ifndef Q_MOC_RUN // moc can't handle some boost macro's
+#include "spsc_queue.hpp"
+#endif
+
+/* Log channel for the process thread. post() only copies a fixed size
+ * record into a lock-free queue, so it doesn't allocate or lock;
+ * another thread formats and prints the records with flush().
+ *
+ * The strings must outlive the record, so pass string literals or
+ * static strings like src_strerror() returns. */
+class RtLog {
+
+public:
+  RtLog() : nDropped(0), reportedDropped(0) {};
+
+  // process thread: log message, followed by detail or values
+  void post(const char *message, const char *detail=nullptr) { push(message, detail, 0, 0, 0); }
+  void post(const char *message, long a) { push(message, nullptr, 1, a, 0); }
+  void post(const char *message, long a, long b) { push(message, nullptr, 2, a, b); }
+
+  // any other single thread: print the pending records with qDebug(),
+  // returns the number printed
+  unsigned int flush();
+  // records lost because the queue was full
+  unsigned long dropped() const { return nDropped; }
+
+private:
+  struct Record {
+    const char *message;
+    const char *detail;
+    unsigned int nValues;
+    long values[2];
+  };
+
+  boost::lockfree::spsc_queue<Record, boost::lockfree::capacity<256> > records;
+  std::atomic<unsigned long> nDropped;
+  unsigned long reportedDropped;
+
+  void push(const char *message, const char *detail, unsigned int nValues, long a, long b);
+};
+
+#endif
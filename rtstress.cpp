@@ -0,0 +1,98 @@
+#include "rtcheck.h"
+#include "jackplayer.h"
+#include "nullbackend.h"
+#include "wave.h"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+/* A wave of noise, at a rate other than the backend's, so that all
+ * playback goes through the resamplers. */
+static Wave noise(unsigned int frames, unsigned int channels, std::mt19937 &rng) {
+  std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+  vector<float> samples(frames*channels);
+  for(auto &s : samples) {
+    s = dist(rng);
+  }
+  return Wave(std::move(samples), channels, 44100);
+}
+
+int rtStress(unsigned long periods, const char *streamFile) {
+  const unsigned int period = 128;
+  auto backend = new NullBackend(48000, period, NullBackend::Manual);
+  JackPlayer player(0, 2, backend);
+  std::mt19937 rng(1);
+
+  unsigned int frames = 44100;
+  player.loadWave(noise(frames, 2, rng));
+  backend->run(period);
+
+  const auto before = RtCheck::violations();
+  for(unsigned long i=0; i < periods; ++i) {
+    auto r = rng();
+    const unsigned int a = r % frames, b = (r >> 8) % frames;
+    const auto start = std::min(a, b), end = std::max(a, b);
+
+    switch(r % 16) {
+    case 0: player.play(start, end); break;
+    case 1: player.loop(start, end); break;
+    case 2: player.pause(); break;
+    case 3: player.stop(); break;
+    case 4: case 5: case 6: player.trigger(start, end); break;
+    case 7: {
+      MidiEvent e{static_cast<unsigned int>((r >> 4) % period), 3, {0x90, static_cast<unsigned char>(36 + r % 8), 100}};
+      backend->sendMidi(e);
+      break;
+    }
+    case 8:
+      player.setSlices({{0, frames/4}, {frames/4, frames/2}, {frames/2, frames}});
+      break;
+    case 9:
+      player.setLoop(start, end);
+      break;
+    case 10:
+      if (i % 64 == 10) {
+        player.setRouting(MixMatrix::defaultRouting(r % 2 ? 1 : 2, 2));
+      }
+      break;
+    case 11:
+      if (i % 128 == 11) {
+        // swap waves of different sizes and channel counts
+        frames = 4410 + r % 88200;
+        player.loadWave(noise(frames, 1 + r % 2, rng));
+      }
+      break;
+    case 12:
+      if (streamFile && i % 256 == 12) {
+        player.loadStream(streamFile, 0.5);
+        player.play();
+      }
+      break;
+    default:
+      break;
+    }
+    backend->run(period);
+    if (i % 16 == 0) {
+      // let the reclaim thread, which runs at idle priority, catch up
+      // like it does between real periods
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  const auto found = RtCheck::violations() - before;
+  const auto stats = player.stats();
+  cerr << "rt-stress: " << periods << " periods, " << found << " RT violations, "
+       << stats.deferredFrees << " deferred frees, "
+       << stats.queueFullEvents << " full queues, "
+       << stats.voicesStolen << " voices stolen" << endl;
+  return found ? 1 : 0;
+}
@@ -0,0 +1,88 @@
+#include "samplemap.h"
+
+#include <fstream>
+#include <stdexcept>
+
+using std::string;
+
+static const unsigned int lastNote = 127;
+
+static std::ofstream open(const string &fileName) {
+  std::ofstream out(fileName);
+  if (!out) {
+    throw std::runtime_error("Error opening file " + fileName);
+  }
+  return out;
+}
+
+static void close(std::ofstream &out, const string &fileName) {
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Error writing file " + fileName);
+  }
+}
+
+/* A region per slice with a key of its own; a region without one would
+ * play on every key, so slices past the last note are left out. */
+void SampleMap::writeSfz(const string &fileName) const {
+  auto out = open(fileName);
+  out << "// " << slices.size() << " slices of " << sample << "\n"
+      << "<group> sample=" << sample << "\n";
+  for(unsigned int i=0; i < slices.size() && baseNote + i <= lastNote; ++i) {
+    const auto &s = slices[i];
+    if (s.second <= s.first) {
+      continue;
+    }
+    // end is the last frame played
+    out << "<region> key=" << baseNote + i << " offset=" << s.first
+        << " end=" << s.second - 1 << "\n";
+  }
+  if (slices.size() > lastNote + 1 - baseNote) {
+    out << "// slices after " << lastNote + 1 - baseNote << " have no key\n";
+  }
+  close(out, fileName);
+}
+
+string jsonString(const string &s) {
+  string q = "\"";
+  for(char c : s) {
+    if (c == '"' || c == '\\') {
+      q += '\\';
+      q += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      static const char hex[] = "0123456789abcdef";
+      q += "\\u00";
+      q += hex[c >> 4];
+      q += hex[c & 0xf];
+    } else {
+      q += c;
+    }
+  }
+  return q + '"';
+}
+
+/* Slices past the last note get a null key. */
+void SampleMap::writeJson(const string &fileName) const {
+  auto out = open(fileName);
+  out << "{\n"
+      << "  \"file\": " << jsonString(sample) << ",\n"
+      << "  \"sampleRate\": " << sampleRate << ",\n"
+      << "  \"channels\": " << channels << ",\n"
+      << "  \"frames\": " << frames << ",\n"
+      << "  \"slices\": [";
+  for(unsigned int i=0; i < slices.size(); ++i) {
+    out << (i ? ",\n" : "\n")
+        << "    {\"index\": " << i
+        << ", \"start\": " << slices[i].first
+        << ", \"end\": " << slices[i].second
+        << ", \"key\": ";
+    if (baseNote + i <= lastNote) {
+      out << baseNote + i;
+    } else {
+      out << "null";
+    }
+    out << "}";
+  }
+  out << "\n  ]\n}\n";
+  close(out, fileName);
+}
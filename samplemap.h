@@ -0,0 +1,28 @@
+#ifndef SAMPLEMAP_H
+#define SAMPLEMAP_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/* The slices of one sample file as offsets into it, and the MIDI keys
+ * that play them: slice i on baseNote + i, as in JackPlayer::setSlices().
+ * Written next to the file as an SFZ for samplers, and as a JSON slice
+ * map for everything else. Both throw std::runtime_error if the file
+ * can't be written. */
+struct SampleMap {
+  std::string sample; // the file, relative to the map
+  unsigned int sampleRate;
+  unsigned int channels;
+  unsigned long frames;
+  std::vector<std::pair<unsigned long, unsigned long> > slices; // [start, end)
+  unsigned int baseNote;
+
+  void writeSfz(const std::string &fileName) const;
+  void writeJson(const std::string &fileName) const;
+};
+
+// s as a JSON string literal, quoted and escaped
+std::string jsonString(const std::string &s);
+
+#endif
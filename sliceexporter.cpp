@@ -0,0 +1,253 @@
+#include "sliceexporter.h"
+#include "pcmquantizer.h"
+#include "resampler.h"
+#include "samplemap.h"
+#include "wave.h"
+#include "wavwriter.h"
+
+#include <sndfile.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+
+// frames per write, and per call to the resampler
+static const unsigned long chunkFrames = 16384;
+// peak level of normalized slices: -0.1 dBFS, some headroom for the
+// peaks between samples
+static const float normalizedPeak = 0.989f;
+
+SliceExporter::SliceExporter(const Wave &wave, const ExportFormat &format) :
+  wave(wave), rate(format.sampleRate ? format.sampleRate : wave.samplerate), format(format),
+  nextJob(0), framesDone(0), framesTotal(0), running(0), cancelled(false) {
+}
+
+SliceExporter::~SliceExporter() {
+  cancel();
+  for(auto &t : pool) {
+    t.join();
+  }
+}
+
+void SliceExporter::prepare(vector<ExportJob> newJobs) {
+  jobs = std::move(newJobs);
+  nextJob = 0;
+  framesTotal = 0;
+  for(auto &job : jobs) {
+    framesTotal += job.end - job.start;
+  }
+  // the threads share one filter table
+  filter = PolyphaseFilter::create(wave.samplerate, rate, wave.channels);
+}
+
+void SliceExporter::start(vector<ExportJob> newJobs, unsigned int threads) {
+  prepare(std::move(newJobs));
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min<unsigned long>(threads, jobs.size());
+  running = threads;
+  for(unsigned int i=0; i < threads; ++i) {
+    pool.emplace_back(&SliceExporter::work, this);
+  }
+}
+
+void SliceExporter::run(vector<ExportJob> newJobs) {
+  prepare(std::move(newJobs));
+  running = 1;
+  work();
+  wait();
+}
+
+void SliceExporter::cancel() {
+  cancelled = true;
+}
+
+void SliceExporter::wait() {
+  for(auto &t : pool) {
+    t.join();
+  }
+  pool.clear();
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+}
+
+/* Take jobs until there are none left, or we are cancelled. A slice
+ * that isn't written completely is removed. */
+void SliceExporter::work() {
+  for(auto i = nextJob++; i < jobs.size() && !cancelled; i = nextJob++) {
+    try {
+      if (!write(jobs[i], i + 1)) {
+        std::remove(jobs[i].fileName.c_str());
+      }
+    } catch (std::exception &e) {
+      std::remove(jobs[i].fileName.c_str());
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (error.empty()) {
+        error = e.what();
+      }
+      // one failed slice fails the export
+      cancelled = true;
+    }
+  }
+  --running;
+}
+
+unsigned long SliceExporter::outputFrame(unsigned long frame) const {
+  if (rate == wave.samplerate) {
+    return frame;
+  }
+  return lround(frame * (static_cast<double>(rate) / wave.samplerate));
+}
+
+/* Write one slice; false if cancelled before it was done. seed: for
+ * the dither, so that exports are reproducible. */
+bool SliceExporter::write(const ExportJob &job, uint32_t seed) {
+  if (!job.cues.empty()) {
+    return writeSampleMap(job, seed);
+  }
+  const int subtype = format.bits == 16 ? SF_FORMAT_PCM_16
+    : format.bits == 24 ? SF_FORMAT_PCM_24 : SF_FORMAT_FLOAT;
+  SndfileHandle outFile(job.fileName.c_str(), SFM_WRITE, SF_FORMAT_WAV | subtype, wave.channels, rate);
+  if (!outFile) {
+    throw std::runtime_error("Error opening file " + job.fileName);
+  }
+  return writeFrames(outFile, job, seed);
+}
+
+/* The slice in one file with its cuts as cue points, then the sample
+ * map files once it is complete. */
+bool SliceExporter::writeSampleMap(const ExportJob &job, uint32_t seed) {
+  SampleMap map;
+  map.sampleRate = rate;
+  map.channels = wave.channels;
+  map.frames = outputFrame(job.end - job.start);
+  map.baseNote = 36; // as JackPlayer
+  std::vector<unsigned long> cues;
+  for(auto cue : job.cues) {
+    cues.push_back(outputFrame(cue));
+  }
+  for(unsigned int i=1; i < cues.size(); ++i) {
+    map.slices.emplace_back(cues[i - 1], cues[i]);
+  }
+  {
+    WavWriter outFile(job.fileName, wave.channels, rate, format.bits, map.frames, cues);
+    // a cancelled or failed file is removed: don't pad it to full length
+    try {
+      if (!writeFrames(outFile, job, seed)) {
+        outFile.discard();
+        return false;
+      }
+    } catch (...) {
+      outFile.discard();
+      throw;
+    }
+  }
+
+  // the maps refer to the file by its name, next to them
+  const auto slash = job.fileName.rfind('/');
+  map.sample = slash == string::npos ? job.fileName : job.fileName.substr(slash + 1);
+  if (!job.sfzName.empty()) {
+    map.writeSfz(job.sfzName);
+  }
+  if (!job.jsonName.empty()) {
+    map.writeJson(job.jsonName);
+  }
+  return true;
+}
+
+/* The output stage, into an open SndfileHandle or WavWriter. */
+template<typename File>
+bool SliceExporter::writeFrames(File &outFile, const ExportJob &job, uint32_t seed) {
+  const auto channels = wave.channels;
+  const float *in = &wave.samples[job.start*channels];
+  const unsigned long frames = job.end - job.start;
+
+  float gain = format.gain;
+  if (format.normalize) {
+    float peak = 0.f;
+    for(unsigned long i=0; i < frames*channels; ++i) {
+      peak = std::max(peak, std::fabs(in[i]));
+    }
+    gain = peak > 0.f ? normalizedPeak/peak : 1.f;
+  }
+
+  // the output stage: gain, then dither and quantization for PCM;
+  // the file only packs the bits
+  std::unique_ptr<PcmQuantizer> quantizer;
+  if (format.bits != 32) {
+    quantizer.reset(new PcmQuantizer(channels, format.bits, format.dither, format.noiseShaping, seed));
+    quantizer->setGain(gain);
+  }
+  vector<float> scaled(quantizer || gain == 1.f ? 0 : chunkFrames*channels);
+  vector<int32_t> pcm(quantizer ? chunkFrames*channels : 0);
+  auto writef = [&] (const float *data, unsigned long n) {
+    long written;
+    if (quantizer) {
+      quantizer->convert(data, n*channels, pcm.data());
+      written = outFile.writef(pcm.data(), n);
+    } else if (gain != 1.f) {
+      for(unsigned long i=0; i < n*channels; ++i) {
+        scaled[i] = gain*data[i];
+      }
+      written = outFile.writef(scaled.data(), n);
+    } else {
+      written = outFile.writef(data, n);
+    }
+    if (written != static_cast<long>(n)) {
+      throw std::runtime_error("Error writing file " + job.fileName);
+    }
+  };
+
+  if (rate == wave.samplerate) {
+    for(unsigned long done=0; done < frames; ) {
+      if (cancelled) {
+        return false;
+      }
+      const auto n = std::min(chunkFrames, frames - done);
+      writef(in + done*channels, n);
+      done += n;
+      framesDone += n;
+    }
+    return true;
+  }
+
+  Resampler resampler(channels, filter);
+  const double ratio = static_cast<double>(rate) / wave.samplerate;
+  const unsigned long outFrames = outputFrame(frames);
+  vector<float> out(chunkFrames*channels);
+  // after the slice, silence flushes the last frames out of the filter
+  const vector<float> silence(chunkFrames*channels, 0.f);
+  unsigned long used = 0;
+  for(unsigned long written=0; written < outFrames; ) {
+    if (cancelled) {
+      return false;
+    }
+    const bool tail = (used == frames);
+    SRC_DATA data;
+    data.data_in = tail ? silence.data() : in + used*channels;
+    data.input_frames = tail ? chunkFrames : std::min(chunkFrames, frames - used);
+    data.data_out = out.data();
+    data.output_frames = std::min(chunkFrames, outFrames - written);
+    data.src_ratio = ratio;
+    data.end_of_input = tail;
+    if (auto e = resampler.process(data)) {
+      throw std::runtime_error(src_strerror(e));
+    }
+    if (!tail) {
+      used += data.input_frames_used;
+      framesDone += data.input_frames_used;
+    } else if (!data.output_frames_gen) {
+      // libsamplerate has nothing left
+      break;
+    }
+    writef(out.data(), data.output_frames_gen);
+    written += data.output_frames_gen;
+  }
+  return true;
+}
@@ -0,0 +1,94 @@
+#ifndef SLICEEXPORTER_H
+#define SLICEEXPORTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class PolyphaseFilter;
+class Wave;
+
+// one slice of the wave, in frames, and the file to write it to
+struct ExportJob {
+  std::string fileName;
+  unsigned int start;
+  unsigned int end;
+  // for a sample map: the cuts in the slice, frames from its start.
+  // They are marked in the file by a WavWriter, and the slices between
+  // them listed in the SFZ and JSON files named, if any; see SampleMap
+  std::vector<unsigned int> cues;
+  std::string sfzName;
+  std::string jsonName;
+};
+
+// how the slices are written
+struct ExportFormat {
+  unsigned int sampleRate; // 0 to keep the rate of the wave
+  unsigned int bits; // 16 or 24 for PCM, 32 for float
+  float gain; // linear
+  bool normalize; // each slice to just below full scale, instead of gain
+  bool dither; // PCM only, see PcmQuantizer
+  bool noiseShaping;
+};
+
+/* Writes slices of a Wave to files in the background, several at a
+ * time on a pool of threads, each resampling and encoding its own
+ * slice. The caller polls progress() and may cancel(); files that were
+ * not finished are removed. The Wave has to outlive the export.
+ *
+ * Each slice goes through the output stage in chunks: resampling, then
+ * gain and, for PCM, dither and quantization by a PcmQuantizer. */
+class SliceExporter {
+
+public:
+  SliceExporter(const Wave &wave, const ExportFormat &format);
+  // cancels, and waits for the threads
+  ~SliceExporter();
+
+  // start writing jobs, 'threads' at a time: 0 for one per core
+  void start(std::vector<ExportJob> jobs, unsigned int threads=0);
+  // write jobs on the calling thread instead, for a caller with a pool
+  // of its own; throws like wait()
+  void run(std::vector<ExportJob> jobs);
+  void cancel();
+  // frames of the wave written so far, and in all
+  unsigned long progress() const { return framesDone; }
+  unsigned long total() const { return framesTotal; }
+  bool finished() const { return running == 0; }
+  bool wasCancelled() const { return cancelled; }
+  // waits for the threads to finish; throws std::runtime_error with the
+  // first error if a slice could not be written
+  void wait();
+
+  unsigned int sampleRate() const { return rate; }
+  // a frame of the wave in the output, at the output rate
+  unsigned long outputFrame(unsigned long frame) const;
+
+private:
+  const Wave &wave;
+  const unsigned int rate;
+  const ExportFormat format;
+  std::shared_ptr<const PolyphaseFilter> filter;
+  std::vector<ExportJob> jobs;
+  std::vector<std::thread> pool;
+  std::atomic<unsigned long> nextJob;
+  std::atomic<unsigned long> framesDone;
+  unsigned long framesTotal;
+  std::atomic<unsigned int> running;
+  std::atomic<bool> cancelled;
+  std::mutex errorMutex;
+  std::string error;
+
+  void prepare(std::vector<ExportJob> newJobs);
+  void work();
+  bool write(const ExportJob &job, uint32_t seed);
+  bool writeSampleMap(const ExportJob &job, uint32_t seed);
+  template<typename File>
+  bool writeFrames(File &outFile, const ExportJob &job, uint32_t seed);
+};
+
+#endif
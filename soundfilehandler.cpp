@@ -3,8 +3,14 @@
 #include <sndfile.hh>
 #include <mpg123.h>
 
+#include <QFileInfo>
 #include <QString>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -66,6 +72,169 @@ static Wave read_mp3(const QString & fileName) {
   return Wave(std::move(samples), channels, rate);
 }
 
+static uint32_t get32(const char *p) {
+  const auto *u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | u[1] << 8 | u[2] << 16 | static_cast<uint32_t>(u[3]) << 24;
+}
+
+/* The cue points and the loops of the smpl chunk of a WAV file. Walks
+ * the chunk headers and seeks past everything else, the samples too. */
+static vector<unsigned int> read_wav_cuts(const string &fileName) {
+  vector<unsigned int> cuts;
+  std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+  const auto length = in.tellg();
+  in.seekg(0);
+  char header[12];
+  if (!in.read(header, 12) || string(header, 4) != "RIFF" || string(header + 8, 4) != "WAVE")
+    return cuts;
+
+  char chunk[8];
+  while (in.read(chunk, 8)) {
+    const string id(chunk, 4);
+    const uint32_t size = get32(chunk + 4);
+    if (id == "cue " || id == "smpl") {
+      // the size comes from the file: a damaged one may claim more
+      // than there is
+      if (size > length - in.tellg())
+        break;
+      vector<char> data(size);
+      if (!in.read(data.data(), size))
+        break;
+      if (id == "cue " && size >= 4) {
+        // id, position, chunk id, chunk start, block start, sample offset
+        const uint32_t n = std::min<uint32_t>(get32(&data[0]), (size - 4) / 24);
+        for(uint32_t i=0; i < n; ++i) {
+          cuts.push_back(get32(&data[4 + 24*i + 20]));
+        }
+      } else if (id == "smpl" && size >= 36) {
+        // cue id, type, start, end (the last frame), fraction, play count
+        const uint32_t n = std::min<uint32_t>(get32(&data[28]), (size - 36) / 24);
+        for(uint32_t i=0; i < n; ++i) {
+          cuts.push_back(get32(&data[36 + 24*i + 8]));
+          cuts.push_back(get32(&data[36 + 24*i + 12]) + 1);
+        }
+      }
+      in.seekg(size & 1, std::ios::cur);
+    } else {
+      in.seekg(size + (size & 1), std::ios::cur);
+    }
+  }
+  return cuts;
+}
+
+/* The last part of a path, after either kind of slash */
+static string base_name(const string &path) {
+  const auto slash = path.find_last_of("/\\");
+  return slash == string::npos ? path : path.substr(slash + 1);
+}
+
+/* The regions of an SFZ that play sampleName: offset, and end, the last
+ * frame played. A region plays the sample of its own sample opcode, or
+ * of the last header before it that had one. */
+static vector<unsigned int> read_sfz_cuts(const string &fileName, const string &sampleName) {
+  vector<unsigned int> cuts;
+  std::ifstream in(fileName);
+  string line, inherited, sample;
+  bool inRegion = false;
+  vector<unsigned int> region; // offset and end + 1 of the current region
+  auto addFrame = [&](long frame) {
+    if (frame >= 0 && frame <= UINT32_MAX) {
+      region.push_back(frame);
+    }
+  };
+  auto endRegion = [&]() {
+    if (inRegion && base_name(sample.empty() ? inherited : sample) == sampleName) {
+      cuts.insert(cuts.end(), region.begin(), region.end());
+    }
+    region.clear();
+    sample.clear();
+  };
+  while (std::getline(in, line)) {
+    std::istringstream split(line.substr(0, line.find("//")));
+    vector<string> words;
+    for(string word; split >> word; ) {
+      words.push_back(word);
+    }
+    for(unsigned int i=0; i < words.size(); ++i) {
+      auto word = words[i];
+      if (word[0] == '<') {
+        endRegion();
+        const auto close = word.find('>');
+        inRegion = word.compare(0, close, "<region") == 0;
+        word.erase(0, close == string::npos ? word.size() : close + 1);
+      }
+      if (word.compare(0, 7, "sample=") == 0) {
+        // the path may have spaces: it runs up to the next opcode
+        string path = word.substr(7);
+        while (i + 1 < words.size() && words[i + 1][0] != '<'
+               && words[i + 1].find('=') == string::npos) {
+          path += " " + words[++i];
+        }
+        (inRegion ? sample : inherited) = path;
+      } else if (!inRegion) {
+        continue;
+      } else if (word.compare(0, 7, "offset=") == 0) {
+        addFrame(std::stol(word.substr(7)));
+      } else if (word.compare(0, 4, "end=") == 0) {
+        const long end = std::stol(word.substr(4));
+        // end=-1 plays nothing
+        if (end >= 0) {
+          addFrame(end + 1);
+        }
+      }
+    }
+  }
+  endRegion();
+  return cuts;
+}
+
+/* An Audacity label track: start and end in seconds, then the label */
+static vector<unsigned int> read_label_cuts(const string &fileName, unsigned int samplerate) {
+  vector<unsigned int> cuts;
+  std::ifstream in(fileName);
+  in.imbue(std::locale::classic());
+  string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    fields.imbue(std::locale::classic());
+    double start, end;
+    // lines starting with a backslash hold the frequencies of the label above
+    if (line.empty() || line[0] == '\\' || !(fields >> start >> end))
+      continue;
+    cuts.push_back(lround(start * samplerate));
+    if (end > start) {
+      cuts.push_back(lround(end * samplerate));
+    }
+  }
+  return cuts;
+}
+
+/* The slice points stored with fileName, in the file or next to it;
+ * sorted, without duplicates, within the wave. */
+static vector<unsigned int> read_cuts(const QString& fileName, const Wave &wave) {
+  vector<unsigned int> cuts;
+  try {
+    cuts = read_wav_cuts(fileName.toUtf8().data());
+    const QFileInfo info(fileName);
+    const auto base = info.path() + "/" + info.completeBaseName();
+    if (cuts.empty() && QFileInfo(base + ".sfz").isFile()) {
+      cuts = read_sfz_cuts((base + ".sfz").toUtf8().data(), info.fileName().toUtf8().data());
+    }
+    if (cuts.empty() && QFileInfo(base + ".txt").isFile()) {
+      cuts = read_label_cuts((base + ".txt").toUtf8().data(), wave.samplerate);
+    }
+  } catch (std::logic_error&) {
+    // a number out of range: not our kind of file after all
+    cuts.clear();
+  }
+
+  const unsigned int frames = wave.samples.size() / wave.channels;
+  std::sort(cuts.begin(), cuts.end());
+  cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+  cuts.erase(std::upper_bound(cuts.begin(), cuts.end(), frames), cuts.end());
+  return cuts;
+}
+
 SoundFileHandler::SoundFileHandler() {
   auto err = mpg123_init();
 
@@ -77,7 +246,15 @@ SoundFileHandler::~SoundFileHandler() {
   mpg123_exit();
 }
 
-Wave SoundFileHandler::read(const QString& fileName) const {
+Wave SoundFileHandler::read(const QString& fileName, vector<unsigned int> *cuts) const {
+  Wave wave = readWave(fileName);
+  if (cuts) {
+    *cuts = read_cuts(fileName, wave);
+  }
+  return wave;
+}
+
+Wave SoundFileHandler::readWave(const QString& fileName) const {
 
   // try to create a "Sndfile" handle
   SndfileHandle fileHandle( fileName.toUtf8().data() , SFM_READ,  SF_FORMAT_WAV | SF_FORMAT_FLOAT , 1 , 44100);
@@ -3,13 +3,23 @@
 
 #include "wave.h"
 
+#include <vector>
+
 class SoundFileHandler {
 
 public:
   SoundFileHandler();
   ~SoundFileHandler();
 
-  Wave read(const QString& fileName) const;
+  // cuts: if not null, gets the slice points stored with the file,
+  // ascending: the cue points and sampler loops of a WAV file, or else
+  // those in a sidecar file with the same base name, an SFZ or an
+  // Audacity label track (.txt). They are read as stored; the audio is
+  // not analysed.
+  Wave read(const QString& fileName, std::vector<unsigned int> *cuts=nullptr) const;
+
+private:
+  Wave readWave(const QString& fileName) const;
 };
 
 #endif
@@ -126,6 +126,20 @@ protected:
         return ret;
     }
 
+    size_t read_available(size_t max_size) const
+    {
+        size_t write_index = write_index_.load(memory_order_acquire);
+        const size_t read_index  = read_index_.load(memory_order_relaxed);
+        return read_available(write_index, read_index, max_size);
+    }
+
+    size_t write_available(size_t max_size) const
+    {
+        size_t write_index = write_index_.load(memory_order_relaxed);
+        const size_t read_index  = read_index_.load(memory_order_acquire);
+        return write_available(write_index, read_index, max_size);
+    }
+
     bool push(T const & t, T * buffer, size_t max_size)
     {
         const size_t write_index = write_index_.load(memory_order_relaxed);  // only written from push thread
@@ -350,6 +364,16 @@ class compile_time_sized_ringbuffer:
     }
 
 public:
+    size_type read_available(void) const
+    {
+        return ringbuffer_base<T>::read_available(max_size);
+    }
+
+    size_type write_available(void) const
+    {
+        return ringbuffer_base<T>::write_available(max_size);
+    }
+
   bool push(T const & t)
     {
         return ringbuffer_base<T>::push(t, data(), max_size);
@@ -439,6 +463,16 @@ public:
         Alloc::deallocate(array_, max_elements_);
     }
 
+    size_type read_available(void) const
+    {
+        return ringbuffer_base<T>::read_available(max_elements_);
+    }
+
+    size_type write_available(void) const
+    {
+        return ringbuffer_base<T>::write_available(max_elements_);
+    }
+
     bool push(T const & t)
     {
         return ringbuffer_base<T>::push(t, &*array_, max_elements_);
@@ -624,6 +658,28 @@ public:
       return base_type::push(std::forward<T>(t));
     }
 
+    /** get number of elements that are available for read
+     *
+     * \return number of available elements that can be popped from the spsc_queue
+     *
+     * \note Thread-safe and wait-free, should only be called from the consumer thread
+     * */
+    size_type read_available() const
+    {
+        return base_type::read_available();
+    }
+
+    /** get write space to write elements
+     *
+     * \return number of elements that can be pushed to the spsc_queue
+     *
+     * \note Thread-safe and wait-free, should only be called from the producer thread
+     * */
+    size_type write_available() const
+    {
+        return base_type::write_available();
+    }
+
     /** Pops one object from ringbuffer.
      *
      * \pre only one thread is allowed to pop data to the spsc_queue
@@ -0,0 +1,167 @@
+#include "voicepool.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <cmath>
+
+const unsigned int VoicePool::defaultVoices;
+const unsigned int VoicePool::fadeFrames;
+const unsigned int VoicePool::spareVoices;
+
+VoicePool::VoicePool(unsigned int channels, std::shared_ptr<const PolyphaseFilter> filter,
+                     unsigned int n) :
+  nChannels(channels), polyphony(n), voices(n ? n + spareVoices : 0), nextSerial(0) {
+  for(auto &v : voices) {
+    v.resampler = Resampler_ptr(new Resampler(nChannels, filter));
+    v.active = v.releasing = false;
+    v.serial = v.inputIndex = v.playbackIndex = v.end = 0;
+    v.level = v.step = 0.f;
+    v.rampLeft = 0;
+    v.delay = 0;
+  }
+}
+
+unsigned int VoicePool::active(void) const {
+  return std::count_if(voices.begin(), voices.end(), [] (const Voice &v) { return v.active; });
+}
+
+bool VoicePool::trigger(unsigned long start, unsigned long end, float gain, unsigned int offset) {
+  if (voices.empty()) {
+    return false;
+  }
+  // with all voices playing, fade out the oldest one
+  const auto playing = std::count_if(voices.begin(), voices.end(),
+                                     [] (const Voice &v) { return v.active && !v.releasing; });
+  const bool steal = (playing >= polyphony);
+  if (steal) {
+    auto oldest = voices.end();
+    for(auto v = voices.begin(); v != voices.end(); ++v) {
+      if (v->active && !v->releasing && (oldest == voices.end() || v->serial < oldest->serial)) {
+        oldest = v;
+      }
+    }
+    fadeOut(*oldest);
+  }
+  // and play on a free voice. Only a burst of steals within a fade can
+  // use up the spares: then cut off the quietest fade out.
+  auto v = std::find_if(voices.begin(), voices.end(), [] (const Voice &v) { return !v.active; });
+  if (v == voices.end()) {
+    v = std::min_element(voices.begin(), voices.end(), [] (const Voice &a, const Voice &b) {
+        return a.releasing > b.releasing || (a.releasing == b.releasing && a.level < b.level);
+      });
+  }
+
+  v->active = true;
+  v->releasing = false;
+  v->serial = nextSerial++;
+  v->inputIndex = v->playbackIndex = start;
+  v->end = end;
+  v->delay = offset;
+  v->resampler->reset();
+  v->level = 0.f;
+  v->step = gain/fadeFrames;
+  v->rampLeft = fadeFrames;
+  return steal;
+}
+
+void VoicePool::release(void) {
+  for(auto &v : voices) {
+    if (v.active && !v.releasing) {
+      fadeOut(v);
+    }
+  }
+}
+
+/* Ramp v down from where it is over 'frames' frames, and stop it at the
+ * end of the ramp */
+void VoicePool::fadeOut(Voice &v, unsigned int frames) {
+  v.releasing = true;
+  v.step = -v.level/frames;
+  v.rampLeft = frames;
+}
+
+int VoicePool::mix(const Wave &wave, double ratio, float *mix, float *scratch, unsigned int nframes) {
+  const auto size = wave.samples.size();
+  int result = 0;
+
+  for(auto &v : voices) {
+    unsigned int done = std::min(v.delay, nframes);
+    v.delay -= done;
+    while (v.active && done < nframes) {
+      const auto end = std::min(v.end, size);
+      const auto inputLeft = (end > v.playbackIndex) ? (end - v.playbackIndex) / nChannels : 0;
+      const unsigned long outputLeft = lround(inputLeft * ratio);
+      if (!inputLeft || !outputLeft) {
+        v.active = false;
+        break;
+      }
+      // be silent by the end of the region, unless already fading out
+      // sooner; until then, stop short of the fade
+      if (outputLeft <= fadeFrames && (!v.releasing || v.rampLeft > outputLeft)) {
+        fadeOut(v, outputLeft);
+      }
+      const unsigned long beforeFade = v.releasing ? outputLeft : outputLeft - fadeFrames;
+
+      if (ratio == 1.) {
+        const auto n = std::min<unsigned long>(beforeFade, nframes - done);
+        add(v, mix + done*nChannels, &wave.samples[v.playbackIndex], n);
+        v.playbackIndex += n*nChannels;
+        done += n;
+      } else {
+        SRC_DATA src_data;
+        src_data.data_in = const_cast<float *>(&wave.samples[v.inputIndex]);
+        src_data.data_out = scratch;
+        src_data.input_frames = (size - v.inputIndex)/nChannels;
+        src_data.output_frames = std::min<unsigned long>(beforeFade, nframes - done);
+        src_data.src_ratio = ratio;
+        src_data.end_of_input = 0;
+
+        int error = v.resampler->process(src_data);
+        if (error) {
+          result = error;
+          v.active = false;
+          break;
+        }
+        v.inputIndex += nChannels * src_data.input_frames_used;
+        v.playbackIndex += nChannels * lround(src_data.output_frames_gen / ratio);
+        if (!src_data.output_frames_gen) {
+          v.active = false;
+          break;
+        }
+        add(v, mix + done*nChannels, scratch, src_data.output_frames_gen);
+        done += src_data.output_frames_gen;
+      }
+    }
+  }
+  return result;
+}
+
+/* Add nframes frames of src to dst, applying the envelope of v. */
+void VoicePool::add(Voice &v, float *dst, const float *src, unsigned int nframes) const {
+  unsigned int f = 0;
+  if (v.rampLeft) {
+    const auto ramp = std::min(v.rampLeft, nframes);
+    for(; f < ramp; ++f) {
+      v.level += v.step;
+      for(unsigned int c=0; c < nChannels; ++c) {
+        dst[f*nChannels + c] += v.level * src[f*nChannels + c];
+      }
+    }
+    v.rampLeft -= ramp;
+    if (!v.rampLeft && v.releasing) {
+      v.active = false;
+      v.level = 0.f;
+      return;
+    }
+  }
+
+  // constant gain: one contiguous loop over all channels, which the
+  // compiler vectorizes
+  const float g = v.level;
+  float * __restrict__ d = dst + f*nChannels;
+  const float * __restrict__ s = src + f*nChannels;
+  const unsigned int n = (nframes - f)*nChannels;
+  for(unsigned int i=0; i < n; ++i) {
+    d[i] += g*s[i];
+  }
+}
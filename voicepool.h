@@ -0,0 +1,76 @@
+#ifndef VOICEPOOL_H
+#define VOICEPOOL_H
+
+#include "resampler.h"
+
+#include <memory>
+#include <vector>
+
+class Wave;
+
+/* Fixed set of voices that play regions of one Wave on top of each
+ * other, e.g. to audition slices. The voices and their resamplers are
+ * all allocated in the constructor, so that trigger() and mix() can run
+ * in the process thread.
+ *
+ * When all voices are busy, trigger() steals the voice that was
+ * triggered longest ago, so the result only depends on the order of
+ * the triggers. The stolen voice fades out while the new region fades
+ * in on one of a few spare voices, so that stealing doesn't click. A
+ * voice also fades out over the last fadeFrames of its region. */
+class VoicePool {
+
+public:
+  static const unsigned int defaultVoices = 16;
+  // length of the fade in and fade out of a voice
+  static const unsigned int fadeFrames = 64;
+  // voices beyond the polyphony, for stolen voices to fade out on
+  static const unsigned int spareVoices = 4;
+
+  // filter: shared by the resamplers of the voices, see Resampler
+  VoicePool(unsigned int channels, std::shared_ptr<const PolyphaseFilter> filter=nullptr,
+            unsigned int voices=defaultVoices);
+
+  // polyphony: the voices that play at once, not counting fade outs
+  unsigned int size() const { return polyphony; }
+  unsigned int active() const;
+
+  // process thread: play samples [start, end) of the wave, starting
+  // 'offset' frames into the next mix(); returns true if a voice had
+  // to be stolen for it
+  bool trigger(unsigned long start, unsigned long end, float gain=1.f, unsigned int offset=0);
+  // process thread: fade out all voices
+  void release();
+
+  // process thread: add the next nframes frames of all voices to mix,
+  // interleaved. ratio is the output rate over the rate of wave;
+  // scratch must hold nframes frames. Returns the last libsamplerate
+  // error, or 0; voices with an error stop.
+  int mix(const Wave &wave, double ratio, float *mix, float *scratch, unsigned int nframes);
+
+private:
+  struct Voice {
+    bool active;
+    bool releasing; // fading out, stops when the ramp ends
+    unsigned long serial; // trigger order
+    unsigned long inputIndex; // next sample to resample
+    unsigned long playbackIndex; // sample at the play position
+    unsigned long end;
+    unsigned int delay; // frames of silence before the voice starts
+    Resampler_ptr resampler;
+    // gain envelope: ramps linearly by 'step' for 'rampLeft' frames
+    float level;
+    float step;
+    unsigned int rampLeft;
+  };
+
+  const unsigned int nChannels;
+  const unsigned int polyphony;
+  std::vector<Voice> voices;
+  unsigned long nextSerial;
+
+  void fadeOut(Voice &v, unsigned int frames=fadeFrames);
+  void add(Voice &v, float *dst, const float *src, unsigned int nframes) const;
+};
+
+#endif
@@ -17,7 +17,10 @@ include( ./config.pri )
 TARGET = wavplayer
 TEMPLATE = app
 
-QMAKE_CXXFLAGS += -std=c++0x
+QMAKE_CXXFLAGS += -std=c++0x -pthread
+QMAKE_LFLAGS += -pthread
+# let gcc vectorize the mixing loops in MixMatrix::apply()
+QMAKE_CXXFLAGS_RELEASE += -ftree-vectorize
 
 LIBS += -ljack -lsndfile -lsamplerate -lmpg123
 
@@ -26,13 +29,66 @@ SOURCES += main.cpp\
     waveview.cpp \
     soundfilehandler.cpp \
     cutter.cpp \
-    jackplayer.cpp
+    jackplayer.cpp \
+    mixmatrix.cpp \
+    jackbackend.cpp \
+    nullbackend.cpp \
+    renderer.cpp \
+    diskstream.cpp \
+    voicepool.cpp \
+    resampler.cpp \
+    onsetdetector.cpp \
+    beattracker.cpp \
+    zerocrossings.cpp \
+    sliceexporter.cpp \
+    pcmquantizer.cpp \
+    wavwriter.cpp \
+    samplemap.cpp \
+    workstealingpool.cpp \
+    batchslicer.cpp \
+    rtlog.cpp
 
 HEADERS  += mainwindow.h \
     waveview.h \
     wave.h \
     soundfilehandler.h \
     cutter.h \
-    jackplayer.h
+    jackplayer.h \
+    mixmatrix.h \
+    audiobackend.h \
+    jackbackend.h \
+    nullbackend.h \
+    renderer.h \
+    diskstream.h \
+    voicepool.h \
+    resampler.h \
+    onsetdetector.h \
+    beattracker.h \
+    zerocrossings.h \
+    sliceexporter.h \
+    pcmquantizer.h \
+    wavwriter.h \
+    samplemap.h \
+    workstealingpool.h \
+    batchslicer.h \
+    rtlog.h \
+    rtcheck.h
 
 FORMS    += mainwindow.ui
+
+# RT-safety checker, see rtcheck.h: qmake CONFIG+=rtcheck
+rtcheck {
+    DEFINES += RT_CHECK
+    SOURCES += rtcheck.cpp \
+        rtstress.cpp
+    QMAKE_CXXFLAGS += -g -fno-omit-frame-pointer
+    QMAKE_LFLAGS += -rdynamic
+    LIBS += -ldl
+}
+
+# benchmarks and checks of the engine, see bench.h: qmake CONFIG+=bench
+bench {
+    DEFINES += ENGINE_BENCH
+    SOURCES += bench.cpp
+    HEADERS += bench.h
+}
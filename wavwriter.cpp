@@ -0,0 +1,196 @@
+#include "wavwriter.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+
+// WAVE format tags
+static const uint16_t formatPcm = 1;
+static const uint16_t formatFloat = 3;
+// the smpl chunk wants the MIDI note that plays the file unchanged
+static const uint32_t unityNote = 60;
+
+static void put16(vector<unsigned char> &out, uint16_t v) {
+  out.push_back(v & 0xff);
+  out.push_back(v >> 8);
+}
+
+static void put32(vector<unsigned char> &out, uint32_t v) {
+  put16(out, v & 0xffff);
+  put16(out, v >> 16);
+}
+
+static void putTag(vector<unsigned char> &out, const char *tag) {
+  out.insert(out.end(), tag, tag + 4);
+}
+
+WavWriter::WavWriter(const string &fileName, unsigned int channels, unsigned int sampleRate,
+                     unsigned int bits, unsigned long frames, const vector<unsigned long> &cues) :
+  file(nullptr), channels(channels), bits(bits), frames(frames), written(0) {
+  const uint32_t blockAlign = channels*bits/8;
+  const uint64_t dataSize = static_cast<uint64_t>(frames)*blockAlign;
+  const bool isFloat = (bits == 32);
+
+  vector<unsigned char> header;
+  putTag(header, "RIFF");
+  put32(header, 0); // patched below
+  putTag(header, "WAVE");
+
+  putTag(header, "fmt ");
+  put32(header, 16);
+  put16(header, isFloat ? formatFloat : formatPcm);
+  put16(header, channels);
+  put32(header, sampleRate);
+  put32(header, sampleRate*blockAlign);
+  put16(header, blockAlign);
+  put16(header, bits);
+
+  if (isFloat) {
+    // required for formats other than PCM
+    putTag(header, "fact");
+    put32(header, 4);
+    put32(header, frames);
+  }
+
+  if (!cues.empty()) {
+    putTag(header, "cue ");
+    put32(header, 4 + 24*cues.size());
+    put32(header, cues.size());
+    for(unsigned int i=0; i < cues.size(); ++i) {
+      put32(header, i + 1); // id
+      put32(header, cues[i]); // position
+      putTag(header, "data");
+      put32(header, 0); // chunk start
+      put32(header, 0); // block start
+      put32(header, cues[i]); // sample offset
+    }
+
+    const auto loops = cues.size() - 1;
+    putTag(header, "smpl");
+    put32(header, 36 + 24*loops);
+    put32(header, 0); // manufacturer
+    put32(header, 0); // product
+    put32(header, 1000000000u/sampleRate); // sample period, ns
+    put32(header, unityNote);
+    put32(header, 0); // pitch fraction
+    put32(header, 0); // SMPTE format
+    put32(header, 0); // SMPTE offset
+    put32(header, loops);
+    put32(header, 0); // sampler data
+    for(unsigned int i=0; i < loops; ++i) {
+      put32(header, i + 1); // cue id
+      put32(header, 0); // forward loop
+      put32(header, cues[i]);
+      put32(header, cues[i + 1] > cues[i] ? cues[i + 1] - 1 : cues[i]); // last frame
+      put32(header, 0); // fraction
+      put32(header, 0); // play count: forever
+    }
+  }
+
+  putTag(header, "data");
+  put32(header, dataSize);
+  const uint64_t riffSize = header.size() - 8 + dataSize + (dataSize & 1);
+  if (riffSize > UINT32_MAX) {
+    throw std::runtime_error("Too long for a WAV file: " + fileName);
+  }
+  header[4] = riffSize & 0xff;
+  header[5] = (riffSize >> 8) & 0xff;
+  header[6] = (riffSize >> 16) & 0xff;
+  header[7] = (riffSize >> 24) & 0xff;
+
+  file = std::fopen(fileName.c_str(), "wb");
+  if (!file) {
+    throw std::runtime_error("Error opening file " + fileName);
+  }
+  if (std::fwrite(header.data(), 1, header.size(), file) != header.size()) {
+    std::fclose(file);
+    throw std::runtime_error("Error writing file " + fileName);
+  }
+}
+
+WavWriter::~WavWriter() {
+  if (!file) {
+    return;
+  }
+  // silence up to the length in the header, and the pad byte of the
+  // data chunk
+  const vector<int> silence(4096*channels, 0);
+  while (written < frames) {
+    const long n = std::min<unsigned long>(4096, frames - written);
+    if (writef(silence.data(), n) != n) {
+      break;
+    }
+  }
+  if ((static_cast<uint64_t>(frames)*channels*bits/8) & 1) {
+    std::fputc(0, file);
+  }
+  std::fclose(file);
+}
+
+void WavWriter::discard() {
+  if (file) {
+    std::fclose(file);
+    file = nullptr;
+  }
+}
+
+long WavWriter::writef(const int *data, long n) {
+  n = std::min<unsigned long>(n, frames - written);
+  const unsigned long samples = n*channels;
+  bytes.resize(samples*bits/8);
+  unsigned char *b = bytes.data();
+  for(unsigned long i=0; i < samples; ++i) {
+    const uint32_t v = data[i];
+    switch (bits) {
+    case 16:
+      *b++ = (v >> 16) & 0xff;
+      *b++ = v >> 24;
+      break;
+    case 24:
+      *b++ = (v >> 8) & 0xff;
+      *b++ = (v >> 16) & 0xff;
+      *b++ = v >> 24;
+      break;
+    default: {
+      const float f = static_cast<int32_t>(v) / 2147483648.f;
+      uint32_t u;
+      std::memcpy(&u, &f, 4);
+      for(int k=0; k < 4; ++k) {
+        *b++ = (u >> 8*k) & 0xff;
+      }
+    }
+    }
+  }
+  return writeBytes(n);
+}
+
+long WavWriter::writef(const float *data, long n) {
+  n = std::min<unsigned long>(n, frames - written);
+  const unsigned long samples = n*channels;
+  if (bits != 32) {
+    // PCM has to be quantized first, see PcmQuantizer
+    return 0;
+  }
+  bytes.resize(samples*4);
+  unsigned char *b = bytes.data();
+  for(unsigned long i=0; i < samples; ++i) {
+    uint32_t u;
+    std::memcpy(&u, &data[i], 4);
+    for(int k=0; k < 4; ++k) {
+      *b++ = (u >> 8*k) & 0xff;
+    }
+  }
+  return writeBytes(n);
+}
+
+/* Write the n frames packed into bytes */
+long WavWriter::writeBytes(long n) {
+  if (!file || std::fwrite(bytes.data(), 1, bytes.size(), file) != bytes.size()) {
+    return 0;
+  }
+  written += n;
+  return n;
+}
@@ -0,0 +1,46 @@
+#ifndef WAVWRITER_H
+#define WAVWRITER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/* Writes a WAV file front to back, with a cue chunk and a smpl chunk
+ * marking frames in it, for samplers that slice a file by its cue
+ * points. libsndfile writes at most 100 cues and 16 loops, where a
+ * sample map may have hundreds of slices. The length is given up
+ * front, so that the header and the markers can go first and the
+ * samples follow in one sequential write. */
+class WavWriter {
+
+public:
+  // bits: 16 or 24 for PCM, 32 for float. cues: frames, ascending; the
+  // smpl chunk gets a loop from each cue to the next one. Throws
+  // std::runtime_error if the file can't be opened, or would be too
+  // large for a WAV file.
+  WavWriter(const std::string &fileName, unsigned int channels, unsigned int sampleRate,
+            unsigned int bits, unsigned long frames, const std::vector<unsigned long> &cues);
+  // pads the file with silence to the length given, unless discarded
+  ~WavWriter();
+
+  // close the file as it is, without padding it: for a write that was
+  // cancelled or failed, and whose file is removed
+  void discard();
+
+  // like SndfileHandle::writef(): the frames written. Ints are full
+  // scale at 2^31; floats only go to float files.
+  long writef(const float *data, long n);
+  long writef(const int *data, long n);
+
+private:
+  std::FILE *file;
+  const unsigned int channels;
+  const unsigned int bits;
+  const unsigned long frames;
+  unsigned long written;
+  std::vector<unsigned char> bytes; // a chunk of samples, packed
+
+  long writeBytes(long n);
+};
+
+#endif
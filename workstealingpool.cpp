@@ -0,0 +1,112 @@
+#include "workstealingpool.h"
+
+#include <algorithm>
+
+// the queue of the worker running on this thread, if it is one
+static thread_local const WorkStealingPool *currentPool = nullptr;
+static thread_local unsigned int currentQueue = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned int threads) :
+  queued(0), pending(0), nIdle(0), nextQueue(0), stopping(false) {
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for(unsigned int i=0; i < threads; ++i) {
+    queues.emplace_back(new Queue);
+  }
+  for(unsigned int i=0; i < threads; ++i) {
+    workers.emplace_back(&WorkStealingPool::work, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  taskQueued.notify_all();
+  for(auto &t : workers) {
+    t.join();
+  }
+}
+
+void WorkStealingPool::submit(Task task) {
+  const auto q = (currentPool == this) ? currentQueue : nextQueue++ % queues.size();
+  ++pending;
+  {
+    std::lock_guard<std::mutex> lock(queues[q]->mutex);
+    queues[q]->tasks.push_back(std::move(task));
+    ++queued;
+  }
+  // under the lock, so that a worker about to sleep sees the task
+  std::lock_guard<std::mutex> lock(mutex);
+  taskQueued.notify_one();
+  taskDone.notify_all();
+}
+
+void WorkStealingPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex);
+  allDone.wait(lock, [this] { return pending == 0; });
+}
+
+void WorkStealingPool::helpUntilZero(const std::atomic<unsigned int> &counter) {
+  while (counter) {
+    if (runOne(currentQueue)) {
+      continue;
+    }
+    // the rest is running on other workers: sleep until one of them
+    // is done, or there is something to help with
+    std::unique_lock<std::mutex> lock(mutex);
+    taskDone.wait(lock, [&] { return counter == 0 || queued > 0; });
+  }
+}
+
+/* Run the newest task of queue self, or else steal the oldest one of
+ * another queue; false if there was none. */
+bool WorkStealingPool::runOne(unsigned int self) {
+  Task task;
+  for(unsigned int i=0; i < queues.size() && !task; ++i) {
+    auto &q = *queues[(self + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (!q.tasks.empty()) {
+      if (i == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      --queued;
+    }
+  }
+  if (!task) {
+    return false;
+  }
+  task();
+  // under the lock, so that a helper about to sleep sees the counter
+  // its task changed
+  std::lock_guard<std::mutex> lock(mutex);
+  taskDone.notify_all();
+  if (--pending == 0) {
+    allDone.notify_all();
+  }
+  return true;
+}
+
+void WorkStealingPool::work(unsigned int self) {
+  currentPool = this;
+  currentQueue = self;
+  for(;;) {
+    if (runOne(self)) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    ++nIdle;
+    taskQueued.wait(lock, [this] { return queued > 0 || stopping; });
+    --nIdle;
+    if (stopping && queued == 0) {
+      return;
+    }
+  }
+}
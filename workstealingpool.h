@@ -0,0 +1,63 @@
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A pool of threads with a deque of tasks each. A worker takes its own
+ * newest task first, so that a task's subtasks run while their data is
+ * still in the cache, and when it runs dry steals the oldest task of
+ * another worker, which tends to be the largest piece of work left.
+ * Tasks submitted from outside the pool are dealt out round robin.
+ *
+ * Tasks must not throw. */
+class WorkStealingPool {
+
+public:
+  typedef std::function<void()> Task;
+
+  // threads: 0 for one per core
+  explicit WorkStealingPool(unsigned int threads=0);
+  // waits for all tasks, then stops the threads
+  ~WorkStealingPool();
+
+  void submit(Task task);
+  // wait until all tasks are done; not from a task
+  void wait();
+  // from a task: run other tasks until counter drops to zero, e.g. a
+  // count of subtasks that each decrement it when done. Sleeps while
+  // there is nothing to run.
+  void helpUntilZero(const std::atomic<unsigned int> &counter);
+
+  unsigned int size() const { return workers.size(); }
+  // workers waiting for a task
+  unsigned int idle() const { return nIdle; }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread> workers;
+  std::atomic<unsigned long> queued; // tasks in the queues
+  std::atomic<unsigned long> pending; // tasks not yet done
+  std::atomic<unsigned int> nIdle;
+  std::atomic<unsigned int> nextQueue; // for tasks from outside
+  bool stopping;
+  std::mutex mutex; // for stopping and the condition variables
+  std::condition_variable taskQueued;
+  std::condition_variable allDone;
+  std::condition_variable taskDone; // or queued: for helpUntilZero()
+
+  void work(unsigned int self);
+  bool runOne(unsigned int self);
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "zerocrossings.h"
+#include "wave.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+using std::vector;
+
+static const unsigned long wordsPerBlock = 8;
+
+ZeroCrossings::BitVector::BitVector(unsigned long bits) : words((bits + 63)/64, 0) {
+}
+
+void ZeroCrossings::BitVector::buildDirectory() {
+  const auto nBlocks = (words.size() + wordsPerBlock - 1)/wordsPerBlock;
+  blocks.assign(nBlocks + 1, 0);
+  uint32_t sum = 0;
+  for(unsigned long w=0; w < words.size(); ++w) {
+    if (w % wordsPerBlock == 0) {
+      blocks[w/wordsPerBlock] = sum;
+    }
+    sum += __builtin_popcountll(words[w]);
+  }
+  blocks[nBlocks] = sum;
+}
+
+unsigned long ZeroCrossings::BitVector::rank(unsigned long i) const {
+  const auto w = std::min<unsigned long>(i/64, words.size());
+  const auto b = w/wordsPerBlock;
+  unsigned long r = blocks[b];
+  for(auto j = b*wordsPerBlock; j < w; ++j) {
+    r += __builtin_popcountll(words[j]);
+  }
+  if (i%64 && w < words.size()) {
+    r += __builtin_popcountll(words[w] & ((uint64_t(1) << (i%64)) - 1));
+  }
+  return r;
+}
+
+unsigned long ZeroCrossings::BitVector::select(unsigned long k) const {
+  // the last block with at most k bits before it
+  const auto b = std::upper_bound(blocks.begin(), blocks.end() - 1, k) - blocks.begin() - 1;
+  unsigned long left = k - blocks[b];
+  for(auto w = b*wordsPerBlock; w < words.size(); ++w) {
+    const unsigned long n = __builtin_popcountll(words[w]);
+    if (left < n) {
+      uint64_t word = words[w];
+      for(; left; --left) {
+        word &= word - 1;
+      }
+      return w*64 + __builtin_ctzll(word);
+    }
+    left -= n;
+  }
+  return words.size()*64;
+}
+
+ZeroCrossings::ZeroCrossings(const Wave &wave, unsigned int threads) :
+  wave(wave), nFrames(wave.samples.size() / wave.channels),
+  channels(wave.channels, BitVector(nFrames)) {
+  const unsigned long nWords = (nFrames + 63)/64;
+  if (!threads) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  // a thread per few seconds of audio at least
+  threads = std::min<unsigned long>(threads, nWords/4096 + 1);
+
+  // the threads write whole words, so they don't share any
+  vector<std::thread> pool;
+  const auto chunk = (nWords + threads - 1) / threads;
+  for(unsigned long first=0; first < nWords; first += chunk) {
+    pool.emplace_back(&ZeroCrossings::build, this, first, std::min(first + chunk, nWords));
+  }
+  for(auto &t : pool) {
+    t.join();
+  }
+  for(auto &c : channels) {
+    c.buildDirectory();
+  }
+}
+
+/* Set the crossings in words [firstWord, lastWord) of each channel */
+void ZeroCrossings::build(unsigned long firstWord, unsigned long lastWord) {
+  const auto nChannels = wave.channels;
+  const float *x = wave.samples.data();
+  for(unsigned int c=0; c < nChannels; ++c) {
+    auto &words = channels[c].words;
+    for(auto w = firstWord; w < lastWord; ++w) {
+      const unsigned long from = std::max(1ul, w*64);
+      const unsigned long to = std::min(nFrames, (w + 1)*64);
+      uint64_t bits = 0;
+      for(auto i = from; i < to; ++i) {
+        const bool changed = (x[(i - 1)*nChannels + c] < 0.f) != (x[i*nChannels + c] < 0.f);
+        bits |= uint64_t(changed) << (i%64);
+      }
+      words[w] = bits;
+    }
+  }
+}
+
+unsigned long ZeroCrossings::rank(unsigned int channel, unsigned long frame) const {
+  return channels[channel].rank(frame);
+}
+
+unsigned long ZeroCrossings::select(unsigned int channel, unsigned long k) const {
+  return channels[channel].select(k);
+}
+
+unsigned long ZeroCrossings::count(unsigned int channel) const {
+  return channels[channel].count();
+}
+
+unsigned long ZeroCrossings::snap(unsigned long frame, unsigned long maxDistance) const {
+  if (frame >= nFrames) {
+    return frame;
+  }
+  const auto nChannels = wave.channels;
+  auto distance = [frame] (unsigned long i) { return i > frame ? i - frame : frame - i; };
+  // how loud a cut at frame i is: the channels at the first frame of
+  // the slice after it
+  auto level = [this, nChannels] (unsigned long i) {
+    float sum = 0.f;
+    for(unsigned int c=0; c < nChannels; ++c) {
+      sum += std::fabs(wave.samples[i*nChannels + c]);
+    }
+    return sum;
+  };
+
+  unsigned long best = frame;
+  float bestLevel = INFINITY;
+  auto consider = [&] (unsigned long i) {
+    if (i >= nFrames || distance(i) > maxDistance) {
+      return;
+    }
+    const float l = level(i);
+    if (l < bestLevel || (l == bestLevel && distance(i) < distance(best))) {
+      best = i;
+      bestLevel = l;
+    }
+  };
+  // the crossings of each channel on either side of frame. A sign
+  // change lies between two frames; either may be the quieter one.
+  for(const auto &bits : channels) {
+    const auto r = bits.rank(frame);
+    if (r > 0) {
+      const auto before = bits.select(r - 1);
+      consider(before - 1);
+      consider(before);
+    }
+    if (r < bits.count()) {
+      const auto after = bits.select(r);
+      consider(after - 1);
+      consider(after);
+    }
+  }
+  return best;
+}
@@ -0,0 +1,61 @@
+#ifndef ZEROCROSSINGS_H
+#define ZEROCROSSINGS_H
+
+#include <cstdint>
+#include <vector>
+
+class Wave;
+
+/* The zero crossings of each channel of a Wave, to snap cuts to so that
+ * slices start and end without a click. Frame i is a crossing of a
+ * channel if the sign of the channel changes between frames i-1 and i.
+ *
+ * Each channel is a bit vector with a rank/select directory: one count
+ * per 512 bits, 1/16 of the bits on top. That is about 23 MB per channel
+ * for an hour at 48 kHz: 21.6 MB of bits and 1.35 MB of counts. Finding the crossings around
+ * a frame takes a rank and a binary search over the directory, so
+ * snapping stays cheap while dragging across hour-long files. */
+class ZeroCrossings {
+
+public:
+  // build the index of wave, one chunk of frames per thread; threads:
+  // 0 to use one per core
+  ZeroCrossings(const Wave &wave, unsigned int threads=0);
+
+  // the crossing within maxDistance frames of frame where the channels
+  // are closest to zero together, or frame if there is none
+  unsigned long snap(unsigned long frame, unsigned long maxDistance) const;
+
+  unsigned long frames() const { return nFrames; }
+  // crossings of channel before frame, and the k-th crossing (from 0)
+  unsigned long rank(unsigned int channel, unsigned long frame) const;
+  unsigned long select(unsigned int channel, unsigned long k) const;
+  unsigned long count(unsigned int channel) const;
+
+private:
+  class BitVector {
+
+  public:
+    BitVector(unsigned long bits=0);
+
+    void set(unsigned long i) { words[i/64] |= uint64_t(1) << (i%64); }
+    void buildDirectory();
+    unsigned long rank(unsigned long i) const;
+    unsigned long select(unsigned long k) const;
+    unsigned long count() const { return blocks.back(); }
+
+    std::vector<uint64_t> words;
+
+  private:
+    // set bits before each block of wordsPerBlock words
+    std::vector<uint32_t> blocks;
+  };
+
+  const Wave &wave;
+  unsigned long nFrames;
+  std::vector<BitVector> channels;
+
+  void build(unsigned long firstWord, unsigned long lastWord);
+};
+
+#endif